@@ -0,0 +1,241 @@
+/*
+ * bench.c
+ * time repeated renders of the current view
+ *
+ * Copyright (C) 1989, 1990, 1993-1995, 1999 Kirk Lauritz Johnson
+ *
+ * Parts of the source code (as marked) are:
+ *   Copyright (C) 1989, 1990, 1991 by Jim Frost
+ *   Copyright (C) 1992 by Jamie Zawinski <jwz@lucid.com>
+ *
+ * Permission to use, copy, modify and freely distribute xearth for
+ * non-commercial and not-for-profit purposes is hereby granted
+ * without fee, provided that both the above copyright notice and this
+ * permission notice appear in all copies and in supporting
+ * documentation.
+ *
+ * Unisys Corporation holds worldwide patent rights on the Lempel Zev
+ * Welch (LZW) compression technique employed in the CompuServe GIF
+ * image file format as well as in other formats. Unisys has made it
+ * clear, however, that it does not require licensing or fees to be
+ * paid for freely distributed, non-commercial applications (such as
+ * xearth) that employ LZW/GIF technology. Those wishing further
+ * information about licensing the LZW patent should contact Unisys
+ * directly at (lzw_info@unisys.com) or by writing to
+ *
+ *   Unisys Corporation
+ *   Welch Licensing Department
+ *   M/S-C1SW19
+ *   P.O. Box 500
+ *   Blue Bell, PA 19424
+ *
+ * The author makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS,
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "xearth.h"
+#include "kljcpyrt.h"
+
+#include <sys/time.h>
+
+static void   bench_map _P((void));
+static double elapsed _P((struct timeval *));
+static int    bench_row _P((u_char *));
+
+int bench_frames;               /* frames to time for -bench */
+
+static unsigned long checksum;  /* of the rows of the last frame */
+
+
+/* render bench_frames frames of the current view, throwing the
+ * output away, and report how long scanning and rendering took.
+ * each frame goes through the same steps as one from the X display
+ * loop, so the caches kept from frame to frame behave the same way;
+ * in particular, with a fixed position the scan is reused after the
+ * first frame. so that views that do move (-pos orbit, say) move
+ * the same way every time, the frames are a second (times
+ * -timewarp) apart, starting at -time if that was given. with
+ * -mapfile, map lookups get timed too (see bench_map()).
+ */
+void bench_output()
+{
+  int            i;
+  int            reused;
+  int            start_time;
+  double         t;
+  double         scan_sum, scan_min;
+  double         render_sum, render_min;
+  struct timeval start;
+
+  reused     = 0;
+  scan_sum   = 0;
+  scan_min   = 0;
+  render_sum = 0;
+  render_min = 0;
+
+  start_time = (fixed_time != 0) ? fixed_time : (int) time(NULL);
+  for (i=0; i<bench_frames; i++)
+  {
+    fixed_time = start_time + (int) (i * time_warp);
+    compute_positions();
+
+    gettimeofday(&start, NULL);
+    scan_map();
+    do_dots();
+    t = elapsed(&start);
+    scan_sum += t;
+    if ((i == 0) || (t < scan_min)) scan_min = t;
+    reused += scan_reused;
+
+    checksum = 0;
+    gettimeofday(&start, NULL);
+    render(bench_row);
+    t = elapsed(&start);
+    render_sum += t;
+    if ((i == 0) || (t < render_min)) render_min = t;
+  }
+
+  fprintf(stderr, "xearth: %d frames of %dx%d (%d scans reused)\n",
+          bench_frames, wdth, hght, reused);
+  fprintf(stderr, "  scan:   %8.3f ms/frame (min %8.3f)\n",
+          scan_sum / bench_frames, scan_min);
+  fprintf(stderr, "  render: %8.3f ms/frame (min %8.3f)\n",
+          render_sum / bench_frames, render_min);
+  fprintf(stderr, "  total:  %8.3f ms/frame\n",
+          (scan_sum + render_sum) / bench_frames);
+  fprintf(stderr, "  checksum of last frame: %08lx\n", checksum);
+
+  if (mapfile != NULL)
+    bench_map();
+}
+
+
+/* look up the map at a grid of wdth by hght points, spread evenly in
+ * latitude and longitude, once per frame: through the texture the
+ * way render() does, both working out the texel coordinates each
+ * time and with them already worked out (as when render() has them
+ * cached), and through gd the way xearth used to.
+ * also count the points where the two disagree, which should be none
+ * unless -bilinear is on or the view is small enough to use a
+ * half-size copy of the map.
+ */
+static void bench_map()
+{
+  int            i, j, k;
+  int            differ;
+  int            ngroups;
+  int            sizes[2*(MAX_OVERLAY+1)];
+  double        *lat;
+  double        *lon;
+  double         tex_sum, cached_sum, gd_sum;
+  TexCoord      *coords;
+  TexCoord      *c;
+  struct timeval start;
+
+  if (!gd_map_open())
+  {
+    fprintf(stderr, "xearth: can't read %s with gd, not timing it\n",
+            mapfile);
+    return;
+  }
+
+  lat = (double *) malloc((unsigned) sizeof(double) * hght);
+  lon = (double *) malloc((unsigned) sizeof(double) * wdth);
+  ngroups = tex_groups(sizes);
+  coords  = (TexCoord *) malloc((unsigned) sizeof(TexCoord) *
+                                (ngroups + 1) * wdth * hght);
+  assert((lat != NULL) && (lon != NULL) && (coords != NULL));
+  for (j=0; j<hght; j++)
+    lat[j] = ((j + 0.5) / hght - 0.5) * M_PI;
+  for (i=0; i<wdth; i++)
+    lon[i] = ((i + 0.5) / wdth - 0.5) * (2*M_PI);
+
+  differ = 0;
+  c      = coords;
+  for (j=0; j<hght; j++)
+    for (i=0; i<wdth; i++)
+    {
+      tex_coord(lat[j], lon[i], c);
+      if (map_pixel(c) != gd_map_pixel(lat[j], lon[i]))
+        differ += 1;
+      c += ngroups;
+    }
+
+  gettimeofday(&start, NULL);
+  for (k=0; k<bench_frames; k++)
+    for (j=0; j<hght; j++)
+      for (i=0; i<wdth; i++)
+      {
+        tex_coord(lat[j], lon[i], coords);
+        map_pixel(coords);
+      }
+  tex_sum = elapsed(&start);
+
+  gettimeofday(&start, NULL);
+  for (k=0; k<bench_frames; k++)
+  {
+    c = coords;
+    for (j=0; j<hght*wdth; j++)
+    {
+      map_pixel(c);
+      c += ngroups;
+    }
+  }
+  cached_sum = elapsed(&start);
+
+  gettimeofday(&start, NULL);
+  for (k=0; k<bench_frames; k++)
+    for (j=0; j<hght; j++)
+      for (i=0; i<wdth; i++)
+        gd_map_pixel(lat[j], lon[i]);
+  gd_sum = elapsed(&start);
+
+  fprintf(stderr, "  map lookups (%d per frame, %d differ):\n",
+          wdth * hght, differ);
+  fprintf(stderr, "    texture: %8.3f ms/frame (%.3f with coordinates cached)\n",
+          tex_sum / bench_frames, cached_sum / bench_frames);
+  fprintf(stderr, "    gd:      %8.3f ms/frame\n", gd_sum / bench_frames);
+
+  free(lat);
+  free(lon);
+  free(coords);
+  gd_map_close();
+}
+
+
+/* milliseconds since start
+ */
+static double elapsed(start)
+     struct timeval *start;
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return ((now.tv_sec - start->tv_sec) * 1e3 +
+          (now.tv_usec - start->tv_usec) * 1e-3);
+}
+
+
+/* render() callback; just keeps a checksum of the rows, so runs
+ * that should render the same thing can be compared
+ */
+static int bench_row(row)
+     u_char *row;
+{
+  int i, i_lim;
+
+  i_lim = wdth*3;
+  for (i=0; i<i_lim; i++)
+    checksum = ((checksum * 31) + row[i]) & 0xffffffffUL;
+
+  return 0;
+}
@@ -103,3 +103,31 @@ void *extarr_next(x)
 
   return rslt;
 }
+
+
+/* like extarr_next(), but reserves n consecutive elements at once
+ * and returns a pointer to the first of them
+ */
+void *extarr_extend(x, n)
+     ExtArr   x;
+     unsigned n;
+{
+  unsigned limit;
+  void    *rslt;
+
+  limit = x->limit;
+  if (x->count + n > limit)
+  {
+    while (x->count + n > limit)
+      limit *= 2;
+
+    x->body = (void *) realloc(x->body, (unsigned) x->eltsize*limit);
+    assert(x->body != NULL);
+    x->limit = limit;
+  }
+
+  rslt = (void *) ((char *) x->body + (x->count * x->eltsize));
+  x->count += n;
+
+  return rslt;
+}
@@ -57,5 +57,6 @@ typedef struct extarr
 extern ExtArr extarr_alloc _P((unsigned));
 extern void   extarr_free _P((ExtArr));
 extern void  *extarr_next _P((ExtArr));
+extern void  *extarr_extend _P((ExtArr, unsigned));
 
 #endif
@@ -31,6 +31,12 @@ void font_draw(x, y, s, dots)
         w = (Font_width[c] + 7) / 8;
         for (cy = 0; cy < Font_height; cy++) {
             for (cx = 0; cx < Font_width[c]; cx++) {
+                /* skip dots that fall off the image (render()
+                 * relies on every dot being on it) */
+                if ((x + cx < 0) || (x + cx >= wdth) ||
+                    (y + cy < 0) || (y + cy >= hght)) {
+                    continue;
+                }
                 if (Font_data[c][cy * w + (cx / 8)] & (0x80 >> (cx % 8))) {
                     new = (ScanDot *) extarr_next(dots);
                     new->x    = x + cx;
@@ -0,0 +1,331 @@
+/*
+ * img2tex.c
+ * convert an image to a tiled texture file
+ *
+ * Copyright (C) 1989, 1990, 1993-1995, 1999 Kirk Lauritz Johnson
+ *
+ * Parts of the source code (as marked) are:
+ *   Copyright (C) 1989, 1990, 1991 by Jim Frost
+ *   Copyright (C) 1992 by Jamie Zawinski <jwz@lucid.com>
+ *
+ * Permission to use, copy, modify and freely distribute xearth for
+ * non-commercial and not-for-profit purposes is hereby granted
+ * without fee, provided that both the above copyright notice and this
+ * permission notice appear in all copies and in supporting
+ * documentation.
+ *
+ * Unisys Corporation holds worldwide patent rights on the Lempel Zev
+ * Welch (LZW) compression technique employed in the CompuServe GIF
+ * image file format as well as in other formats. Unisys has made it
+ * clear, however, that it does not require licensing or fees to be
+ * paid for freely distributed, non-commercial applications (such as
+ * xearth) that employ LZW/GIF technology. Those wishing further
+ * information about licensing the LZW patent should contact Unisys
+ * directly at (lzw_info@unisys.com) or by writing to
+ *
+ *   Unisys Corporation
+ *   Welch Licensing Department
+ *   M/S-C1SW19
+ *   P.O. Box 500
+ *   Blue Bell, PA 19424
+ *
+ * The author makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS,
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * usage: img2tex image > file
+ *
+ * img2tex converts a GIF, PNG or JPEG image (as taken by xearth's
+ * -mapfile and -overlayfile options) into a tiled texture file (see
+ * TexBinHeader in xearth.h), which those options also take. xearth
+ * maps such files into memory instead of decoding them, and only
+ * reads the tiles a view actually samples, so even huge images cost
+ * no more memory than the part of them in use. the file holds the
+ * half-size copies of the image xearth uses for small views as well.
+ * tiled texture files are specific to the kind of machine they were
+ * written on.
+ */
+
+#include "xearth.h"
+#include "kljcpyrt.h"
+#include <limits.h>
+#include <gd.h>
+
+#define TileShift (8)
+
+static u8or32 *read_image _P((const char *, int *, int *));
+static u8or32 *halve _P((u8or32 *, int, int));
+static u8or32  average _P((u8or32, u8or32, u8or32, u8or32));
+static void    write_tiles _P((u8or32 *, TexBinLevel *));
+static void    write_bytes _P((const char *, long));
+static int     align _P((int));
+
+
+int main(argc, argv)
+     int   argc;
+     char *argv[];
+{
+  int          i, x;
+  int          sx, sy;
+  int          tile;
+  int          ntiles;
+  char        *pad;
+  u8or32      *texels;
+  u8or32      *next;
+  TexBinHeader hdr;
+  TexBinLevel *lvl;
+
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s image > file\n", argv[0]);
+    exit(1);
+  }
+
+  texels = read_image(argv[1], &sx, &sy);
+
+  memset((char *) &hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, TexBinMagic, sizeof(hdr.magic));
+  hdr.byte_order  = MapBinByteOrder;
+  hdr.version     = TexBinVersion;
+  hdr.header_size = sizeof(TexBinHeader);
+  hdr.tile_shift  = TileShift;
+  hdr.tile_ofs    = align(sizeof(TexBinHeader));
+
+  /* blend by alpha if there is any across the middle row (as
+   * load_texture() in overlay.c decides for images)
+   */
+  hdr.alpha = 0;
+  for (x=0; x<sx; x++)
+    if (TexAlpha(texels[(sy/2) * sx + x]) != 0)
+    {
+      hdr.alpha = 1;
+      break;
+    }
+
+  /* lay out the levels, halving down to a couple of texels across
+   * (as build_mipmaps() in overlay.c does)
+   */
+  tile   = 1 << TileShift;
+  ntiles = 0;
+  for (i=0; i<TexBinMaxLevels; i++)
+  {
+    lvl = &(hdr.level[i]);
+    lvl->sx         = sx;
+    lvl->sy         = sy;
+    lvl->tiles_x    = (sx + tile - 1) / tile;
+    lvl->tiles_y    = (sy + tile - 1) / tile;
+    lvl->first_tile = ntiles;
+    ntiles += lvl->tiles_x * lvl->tiles_y;
+    hdr.nlevels = i+1;
+
+    if ((sx < 4) || (sy < 4))
+      break;
+    sx /= 2;
+    sy /= 2;
+  }
+
+  pad = (char *) malloc((unsigned) hdr.tile_ofs);
+  assert(pad != NULL);
+  memset(pad, 0, (unsigned) hdr.tile_ofs);
+  memcpy(pad, (char *) &hdr, sizeof(hdr));
+  write_bytes(pad, (long) hdr.tile_ofs);
+  free(pad);
+
+  for (i=0; i<hdr.nlevels; i++)
+  {
+    lvl = &(hdr.level[i]);
+    write_tiles(texels, lvl);
+    if (i+1 < hdr.nlevels)
+    {
+      next = halve(texels, lvl->sx, lvl->sy);
+      free(texels);
+      texels = next;
+    }
+  }
+  free(texels);
+
+  return 0;
+}
+
+
+/* round n up to a multiple of TexBinAlign
+ */
+static int align(n)
+     int n;
+{
+  return ((n + TexBinAlign - 1) / TexBinAlign) * TexBinAlign;
+}
+
+
+/* decode an image with gd into packed texels (see xearth.h), row by
+ * row, returning its size in *sx and *sy
+ */
+static u8or32 *read_image(name, sx, sy)
+     const char *name;
+     int        *sx;
+     int        *sy;
+{
+  int        x, y, c;
+  u_char     buf[8];
+  u8or32    *rslt;
+  u8or32    *t;
+  FILE      *ins;
+  gdImagePtr im;
+
+  ins = fopen(name, "rb");
+  if (ins == NULL)
+  {
+    fprintf(stderr, "img2tex: unable to open %s\n", name);
+    exit(1);
+  }
+
+  memset(buf, 0, sizeof(buf));
+  fread(buf, 1, sizeof(buf), ins);
+  rewind(ins);
+  if (memcmp(buf, "GIF8", 4) == 0)
+    im = gdImageCreateFromGif(ins);
+  else if (memcmp(buf, "\x89PNG", 4) == 0)
+    im = gdImageCreateFromPng(ins);
+  else if (memcmp(buf, "\xff\xd8", 2) == 0)
+    im = gdImageCreateFromJpeg(ins);
+  else
+  {
+    fprintf(stderr, "img2tex: unknown image file format: %s\n", name);
+    exit(1);
+  }
+  fclose(ins);
+
+  if (im == NULL)
+  {
+    fprintf(stderr, "img2tex: unable to decode %s\n", name);
+    exit(1);
+  }
+
+  /* xearth keeps texel indices within a level in an int
+   */
+  *sx = gdImageSX(im);
+  *sy = gdImageSY(im);
+  if (((double) *sx + (1 << TileShift)) *
+      ((double) *sy + (1 << TileShift)) > INT_MAX)
+  {
+    fprintf(stderr, "img2tex: %s is too large\n", name);
+    exit(1);
+  }
+
+  rslt = (u8or32 *) malloc(sizeof(u8or32) * *sx * *sy);
+  assert(rslt != NULL);
+
+  t = rslt;
+  for (y=0; y<*sy; y++)
+    for (x=0; x<*sx; x++)
+    {
+      c = gdImageGetPixel(im, x, y);
+      *t++ = TexRGBA(gdImageRed(im, c), gdImageGreen(im, c),
+                     gdImageBlue(im, c), gdImageAlpha(im, c));
+    }
+  gdImageDestroy(im);
+
+  return rslt;
+}
+
+
+/* a copy of the sx by sy texels in src, half the size; this has to
+ * match what build_mipmaps() (overlay.c) does
+ */
+static u8or32 *halve(src, sx, sy)
+     u8or32 *src;
+     int     sx;
+     int     sy;
+{
+  int     x, y;
+  u8or32 *rslt;
+  u8or32 *t;
+  u8or32 *r0, *r1;
+
+  rslt = (u8or32 *) malloc(sizeof(u8or32) * (sx/2) * (sy/2));
+  assert(rslt != NULL);
+
+  t = rslt;
+  for (y=0; y<sy/2; y++)
+  {
+    r0 = src + (2*y) * sx;
+    r1 = r0 + sx;
+    for (x=0; x<sx/2; x++)
+      *t++ = average(r0[2*x], r0[2*x+1], r1[2*x], r1[2*x+1]);
+  }
+
+  return rslt;
+}
+
+
+/* average four texels, two bytes of each at a time; this has to
+ * match tex_average() (overlay.c)
+ */
+static u8or32 average(a, b, c, d)
+     u8or32 a, b, c, d;
+{
+  u8or32 lo, hi;
+
+  lo = ((a & 0x00ff00ff) + (b & 0x00ff00ff) +
+        (c & 0x00ff00ff) + (d & 0x00ff00ff) + 0x00020002) >> 2;
+  hi = (((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) +
+        ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff) +
+        0x00020002) >> 2;
+  return (lo & 0x00ff00ff) | ((hi & 0x00ff00ff) << 8);
+}
+
+
+/* write out the tiles of a level (texels row by row), padding the
+ * ones that hang off the right or bottom with zeros
+ */
+static void write_tiles(texels, lvl)
+     u8or32      *texels;
+     TexBinLevel *lvl;
+{
+  int     tx, ty;
+  int     x, y;
+  int     tile;
+  u8or32 *buf;
+  u8or32 *t;
+
+  tile = 1 << TileShift;
+  buf  = (u8or32 *) malloc(sizeof(u8or32) * tile * tile);
+  assert(buf != NULL);
+
+  for (ty=0; ty<lvl->tiles_y; ty++)
+    for (tx=0; tx<lvl->tiles_x; tx++)
+    {
+      t = buf;
+      for (y=ty*tile; y<(ty+1)*tile; y++)
+        for (x=tx*tile; x<(tx+1)*tile; x++)
+          *t++ = ((x < lvl->sx) && (y < lvl->sy))
+            ? texels[y * lvl->sx + x] : 0;
+      write_bytes((char *) buf, (long) sizeof(u8or32) * tile * tile);
+    }
+
+  free(buf);
+}
+
+
+/* write n bytes from buf to standard out
+ */
+static void write_bytes(buf, n)
+     const char *buf;
+     long        n;
+{
+  if (fwrite(buf, 1, (unsigned) n, stdout) != (unsigned) n)
+  {
+    fprintf(stderr, "img2tex: write failed\n");
+    exit(1);
+  }
+}
@@ -0,0 +1,269 @@
+/*
+ * map2bin.c
+ * convert map_data[] to a binary map data file
+ *
+ * Copyright (C) 1989, 1990, 1993-1995, 1999 Kirk Lauritz Johnson
+ *
+ * Parts of the source code (as marked) are:
+ *   Copyright (C) 1989, 1990, 1991 by Jim Frost
+ *   Copyright (C) 1992 by Jamie Zawinski <jwz@lucid.com>
+ *
+ * Permission to use, copy, modify and freely distribute xearth for
+ * non-commercial and not-for-profit purposes is hereby granted
+ * without fee, provided that both the above copyright notice and this
+ * permission notice appear in all copies and in supporting
+ * documentation.
+ *
+ * Unisys Corporation holds worldwide patent rights on the Lempel Zev
+ * Welch (LZW) compression technique employed in the CompuServe GIF
+ * image file format as well as in other formats. Unisys has made it
+ * clear, however, that it does not require licensing or fees to be
+ * paid for freely distributed, non-commercial applications (such as
+ * xearth) that employ LZW/GIF technology. Those wishing further
+ * information about licensing the LZW patent should contact Unisys
+ * directly at (lzw_info@unisys.com) or by writing to
+ *
+ *   Unisys Corporation
+ *   Welch Licensing Department
+ *   M/S-C1SW19
+ *   P.O. Box 500
+ *   Blue Bell, PA 19424
+ *
+ * The author makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS,
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * usage: map2bin [file] > xearth.map
+ *
+ * with no arguments, map2bin converts the map_data[] built into
+ * xearth (mapdata.c). given a file, it instead converts the list of
+ * numbers in it, which must be laid out the same way as map_data[]
+ * (see the comment at the top of mapdata.c); any text up to the
+ * first '{' (such as the beginning of mapdata.c itself) and any C
+ * comments are skipped. the result (see MapBinHeader in xearth.h)
+ * is written to standard out and can be used with xearth's -mapdata
+ * option.
+ */
+
+#include "xearth.h"
+#include "kljcpyrt.h"
+
+static short *read_map_data _P((const char *));
+static void   write_map_bin _P((short *));
+static int    align _P((int));
+
+
+int main(argc, argv)
+     int   argc;
+     char *argv[];
+{
+  short *raw;
+
+  if (argc > 2)
+  {
+    fprintf(stderr, "usage: %s [file] > xearth.map\n", argv[0]);
+    exit(1);
+  }
+
+  raw = (argc == 2) ? read_map_data(argv[1]) : map_data;
+  write_map_bin(raw);
+
+  return 0;
+}
+
+
+/* round n up to a multiple of MapBinAlign
+ */
+static int align(n)
+     int n;
+{
+  return ((n + MapBinAlign - 1) / MapBinAlign) * MapBinAlign;
+}
+
+
+/* read a map_data[]-style list of numbers from a file
+ */
+static short *read_map_data(name)
+     const char *name;
+{
+  int    c, prev;
+  int    n, limit;
+  long   val;
+  short *rslt;
+  FILE  *ins;
+
+  ins = fopen(name, "r");
+  if (ins == NULL)
+  {
+    fprintf(stderr, "map2bin: unable to open %s\n", name);
+    exit(1);
+  }
+
+  /* skip to the opening brace, if there is one
+   */
+  while (((c = getc(ins)) != EOF) && (c != '{'))
+    ;
+  if (c == EOF)
+    rewind(ins);
+
+  limit = 1024;
+  rslt  = (short *) malloc(sizeof(short) * limit);
+  assert(rslt != NULL);
+
+  n = 0;
+  c = getc(ins);
+  while (c != EOF)
+  {
+    if (c == '/')
+    {
+      c = getc(ins);
+      if (c == '*')
+      {
+        prev = 0;
+        while (((c = getc(ins)) != EOF) && !((prev == '*') && (c == '/')))
+          prev = c;
+        c = getc(ins);
+      }
+    }
+    else if ((c == '-') || ((c >= '0') && (c <= '9')))
+    {
+      ungetc(c, ins);
+      if (fscanf(ins, "%ld", &val) != 1)
+      {
+        fprintf(stderr, "map2bin: bad number in %s\n", name);
+        exit(1);
+      }
+
+      if (n == limit)
+      {
+        limit *= 2;
+        rslt = (short *) realloc(rslt, sizeof(short) * limit);
+        assert(rslt != NULL);
+      }
+      rslt[n++] = (short) val;
+
+      c = getc(ins);
+    }
+    else
+    {
+      c = getc(ins);
+    }
+  }
+  fclose(ins);
+
+  /* make sure the list is terminated
+   */
+  if ((n == 0) || (rslt[n-1] != 0))
+  {
+    if (n == limit)
+    {
+      rslt = (short *) realloc(rslt, sizeof(short) * (limit + 1));
+      assert(rslt != NULL);
+    }
+    rslt[n++] = 0;
+  }
+
+  return rslt;
+}
+
+
+/* decode map_data[]-style curves in raw and write them out as a
+ * binary map data file
+ */
+static void write_map_bin(raw)
+     short *raw;
+{
+  int          i, j;
+  int          x, y, z;
+  int          idx;
+  int          size;
+  double       scale;
+  short       *r;
+  char        *buf;
+  MapBinHeader hdr;
+  MapBinCurve *curve;
+  float       *px, *py, *pz;
+
+  memset((char *) &hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, MapBinMagic, sizeof(hdr.magic));
+  hdr.byte_order  = MapBinByteOrder;
+  hdr.version     = MapBinVersion;
+  hdr.header_size = sizeof(MapBinHeader);
+
+  hdr.ncurves = 0;
+  hdr.npoints = 0;
+  for (r=raw; r[0]!=0; r+=2+3*r[0])
+  {
+    if (r[0] < 0)
+    {
+      fprintf(stderr, "map2bin: curve %d has a bad point count\n",
+              hdr.ncurves);
+      exit(1);
+    }
+    hdr.ncurves += 1;
+    hdr.npoints += r[0];
+  }
+
+  hdr.curve_ofs = align(sizeof(MapBinHeader));
+  hdr.x_ofs     = align(hdr.curve_ofs + hdr.ncurves * sizeof(MapBinCurve));
+  hdr.y_ofs     = align(hdr.x_ofs + hdr.npoints * sizeof(float));
+  hdr.z_ofs     = align(hdr.y_ofs + hdr.npoints * sizeof(float));
+  size          = hdr.z_ofs + hdr.npoints * sizeof(float);
+
+  buf = (char *) malloc((unsigned) size);
+  assert(buf != NULL);
+  memset(buf, 0, (unsigned) size);
+  memcpy(buf, (char *) &hdr, sizeof(hdr));
+
+  curve = (MapBinCurve *) (buf + hdr.curve_ofs);
+  px    = (float *) (buf + hdr.x_ofs);
+  py    = (float *) (buf + hdr.y_ofs);
+  pz    = (float *) (buf + hdr.z_ofs);
+
+  /* this has to match what decode_map_data() (scan.c) does with the
+   * built-in map_data[]
+   */
+  scale = 1.0 / MapDataScale;
+  r     = raw;
+  idx   = 0;
+  for (i=0; i<hdr.ncurves; i++)
+  {
+    curve[i].npts = r[0];
+    curve[i].val  = r[1];
+    r += 2;
+
+    x = 0;
+    y = 0;
+    z = 0;
+    for (j=0; j<curve[i].npts; j++)
+    {
+      x += r[0];
+      y += r[1];
+      z += r[2];
+
+      px[idx] = x * scale;
+      py[idx] = y * scale;
+      pz[idx] = z * scale;
+
+      r   += 3;
+      idx += 1;
+    }
+  }
+
+  if (fwrite(buf, 1, (unsigned) size, stdout) != (unsigned) size)
+  {
+    fprintf(stderr, "map2bin: write failed\n");
+    exit(1);
+  }
+  free(buf);
+}
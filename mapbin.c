@@ -0,0 +1,219 @@
+/*
+ * mapbin.c
+ * loading binary map data files
+ *
+ * Copyright (C) 1989, 1990, 1993-1995, 1999 Kirk Lauritz Johnson
+ *
+ * Parts of the source code (as marked) are:
+ *   Copyright (C) 1989, 1990, 1991 by Jim Frost
+ *   Copyright (C) 1992 by Jamie Zawinski <jwz@lucid.com>
+ *
+ * Permission to use, copy, modify and freely distribute xearth for
+ * non-commercial and not-for-profit purposes is hereby granted
+ * without fee, provided that both the above copyright notice and this
+ * permission notice appear in all copies and in supporting
+ * documentation.
+ *
+ * Unisys Corporation holds worldwide patent rights on the Lempel Zev
+ * Welch (LZW) compression technique employed in the CompuServe GIF
+ * image file format as well as in other formats. Unisys has made it
+ * clear, however, that it does not require licensing or fees to be
+ * paid for freely distributed, non-commercial applications (such as
+ * xearth) that employ LZW/GIF technology. Those wishing further
+ * information about licensing the LZW patent should contact Unisys
+ * directly at (lzw_info@unisys.com) or by writing to
+ *
+ *   Unisys Corporation
+ *   Welch Licensing Department
+ *   M/S-C1SW19
+ *   P.O. Box 500
+ *   Blue Bell, PA 19424
+ *
+ * The author makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS,
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "xearth.h"
+#include "kljcpyrt.h"
+
+#ifndef NO_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+static int bad_offset _P((int, long, long));
+
+
+/* load the binary map data file name (see MapBinHeader in
+ * xearth.h for the layout) into data. the file is mapped read-only
+ * and its curve index and points are used in place, so nothing is
+ * copied and processes using the same file share its pages. any
+ * problem with the file (including points that aren't unit vectors)
+ * is fatal.
+ */
+void mapbin_load(name, data)
+     const char *name;
+     MapBinData *data;
+{
+  int           i;
+  long          size;
+  long          total;
+  double        len;
+  char         *base;
+  MapBinHeader *hdr;
+
+  base = map_file(name, &size);
+  if (base == NULL)
+    fatal("unable to read map data file");
+
+  hdr = (MapBinHeader *) base;
+  if ((size < (long) sizeof(MapBinHeader)) ||
+      (memcmp(hdr->magic, MapBinMagic, sizeof(hdr->magic)) != 0))
+    fatal("map data file is not in xearth's binary map format");
+  if ((hdr->byte_order != MapBinByteOrder) ||
+      (hdr->header_size != sizeof(MapBinHeader)))
+    fatal("map data file was written on an incompatible machine");
+  if (hdr->version != MapBinVersion)
+    fatal("map data file is from an unknown version of the format");
+
+  if ((hdr->ncurves < 0) || (hdr->npoints < 0) ||
+      bad_offset(hdr->curve_ofs, hdr->ncurves * (long) sizeof(MapBinCurve),
+                 size) ||
+      bad_offset(hdr->x_ofs, hdr->npoints * (long) sizeof(float), size) ||
+      bad_offset(hdr->y_ofs, hdr->npoints * (long) sizeof(float), size) ||
+      bad_offset(hdr->z_ofs, hdr->npoints * (long) sizeof(float), size))
+    fatal("map data file is truncated or corrupt");
+
+  data->ncurves = hdr->ncurves;
+  data->npoints = hdr->npoints;
+  data->curves  = (MapBinCurve *) (base + hdr->curve_ofs);
+  data->x       = (float *) (base + hdr->x_ofs);
+  data->y       = (float *) (base + hdr->y_ofs);
+  data->z       = (float *) (base + hdr->z_ofs);
+
+  /* make sure the curves account for exactly the points there are
+   */
+  total = 0;
+  for (i=0; i<data->ncurves; i++)
+  {
+    if (data->curves[i].npts <= 0)
+      fatal("map data file has an empty curve");
+    total += data->curves[i].npts;
+  }
+  if (total != data->npoints)
+    fatal("map data file curves and points don't match");
+
+  /* and that every point is on (or, allowing for the rounding in
+   * map_data, very near) the unit sphere; this also catches NaNs
+   * and infinities, which fail both comparisons
+   */
+  for (i=0; i<data->npoints; i++)
+  {
+    len = ((double) data->x[i] * data->x[i] +
+           (double) data->y[i] * data->y[i] +
+           (double) data->z[i] * data->z[i]);
+    if (!((len > 0.99) && (len < 1.01)))
+      fatal("map data file is truncated or corrupt");
+  }
+}
+
+
+/* returns non-zero if len bytes at ofs don't fit in a file of size
+ * bytes (or ofs isn't suitably aligned)
+ */
+static int bad_offset(ofs, len, size)
+     int  ofs;
+     long len;
+     long size;
+{
+  return ((ofs < 0) || ((ofs % MapBinAlign) != 0) ||
+          (len < 0) || (len > size - ofs));
+}
+
+
+/* get the contents of a file into memory (mapped, if possible),
+ * returning NULL if that fails
+ */
+char *map_file(name, size)
+     const char *name;
+     long       *size;
+{
+#ifndef NO_MMAP
+  int         fd;
+  struct stat st;
+  void       *rslt;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  if ((fstat(fd, &st) < 0) || (st.st_size <= 0))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  rslt = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (rslt == MAP_FAILED)
+    return NULL;
+
+  *size = st.st_size;
+  return (char *) rslt;
+#else
+  FILE *ins;
+  long  n;
+  char *rslt;
+
+  ins = fopen(name, "rb");
+  if (ins == NULL)
+    return NULL;
+
+  n    = 0;
+  rslt = NULL;
+  if ((fseek(ins, 0L, SEEK_END) == 0) && ((n = ftell(ins)) > 0))
+  {
+    /* malloc() memory is suitably aligned for the floats; the
+     * offsets within the file are multiples of MapBinAlign
+     */
+    rslt = (char *) malloc((unsigned) n);
+    assert(rslt != NULL);
+
+    rewind(ins);
+    if (fread(rslt, 1, (unsigned) n, ins) != (unsigned) n)
+    {
+      free(rslt);
+      rslt = NULL;
+    }
+  }
+  fclose(ins);
+
+  *size = n;
+  return rslt;
+#endif
+}
+
+
+/* let go of what map_file() returned
+ */
+void unmap_file(base, size)
+     char *base;
+     long  size;
+{
+#ifndef NO_MMAP
+  munmap((void *) base, (size_t) size);
+#else
+  free(base);
+#endif
+}
@@ -1,136 +1,282 @@
 #include "xearth.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <gd.h>
 
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
+/* with threads and inotify, a background thread reloads images that
+ * change on disk (see start_watch())
+ */
+#if !defined(NO_PTHREADS) && !defined(NO_INOTIFY)
+#define TEX_WATCH
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
 #define ImageUnknown (0)
 #define ImageGif     (1)
 #define ImagePng     (2)
 #define ImageJpeg    (3)
+#define ImageTiled   (4)
+
+/* for bilinear sampling, texel coordinates are kept in fixed point
+ * with TEX_SHIFT bits of fraction (which tex_lerp() counts on being 8)
+ */
+#define TEX_SHIFT    (8)
+#define TEX_ONE      (1 << TEX_SHIFT)
+#define TEX_MAX_SIZE (1 << (30 - TEX_SHIFT))
+
+/* a TexCoord that doesn't land on the texture */
+#define TEX_NONE     INT_MIN
+
+/* how close (in texels) to the edge of a texel coord_nearest() has to
+ * land before it checks which side gd would put it on
+ */
+#define NEAREST_EPS  (1e-6)
+
+/* the texel at (x, y) (packed as described in xearth.h); textures
+ * from tiled texture files are stored in square tiles rather than
+ * row by row (see tile_texel())
+ */
+#define TexAt(tex, x, y)                                               \
+    (((tex)->tile_shift == 0)                                          \
+     ? (tex)->texels[(y) * (tex)->sx + (x)]                           \
+     : tile_texel((tex), (x), (y)))
+
+/* render() workers read in tiles as they need them, so a tile
+ * pointer can be filled in by one thread while another looks at it;
+ * where the compiler offers it, make sure a thread that sees the
+ * pointer also sees the tile
+ */
+#if !defined(NO_PTHREADS) && defined(__GNUC__)
+#define TileGet(p)    __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define TileSet(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define TileGet(p)    (p)
+#define TileSet(p, v) ((p) = (v))
+#endif
+
+/* enough about a file to tell when it changes
+ */
+typedef struct {
+    time_t  mtime;
+    off_t   size;
+    dev_t   dev;
+    ino_t   ino;
+} FileStamp;
+
+/* a tiled texture file that tiles are read from as they are first
+ * sampled. the tiles are copied out rather than mapped, so that a
+ * file being rewritten in place can't pull them out from under
+ * render(); once the file has changed since it was opened, no more
+ * tiles are read from it (they come out blank instead) until it
+ * gets reloaded.
+ */
+typedef struct {
+    int       fd;
+    FileStamp stamp;    /* the file when it was opened */
+    long      tile_bytes;
+    u8or32   *blank;    /* a tile of zeros */
+    int       changed;  /* seen to have changed since then? */
+#ifndef NO_PTHREADS
+    pthread_mutex_t lock; /* for fd and filling in tiles */
+#endif
+} TileFile;
+
+/* a map or overlay image, converted on loading so that sampling it
+ * doesn't have to go through gd (or read a tile at a time from a
+ * tiled texture file). textures are kept from one render() to the
+ * next, along with what the file they came from looked like, and
+ * come with a chain of half-size copies for small views.
+ */
+typedef struct texture {
+    u8or32 *texels;     /* the texels (NULL if none or tiled) */
+    int     sx, sy;     /* size in texels */
+    int     tile_shift; /* log2 of tile size (0 if not tiled) */
+    int     tile_mask;  /* tile size - 1 */
+    int     tiles_x;    /* tiles per row of tiles */
+    u8or32 **tiles;     /* each tile, once read (NULL if not tiled) */
+    long    tiles_ofs;  /* where in the file this level's tiles start */
+    TileFile *file;     /* tiled texture file (shared by the levels) */
+    double  xscale;     /* fixed-point texels per radian of longitude */
+    double  yscale;     /* fixed-point texels per radian of latitude */
+    double  nxscale;    /* texels per radian of longitude */
+    double  nyscale;    /* texels per radian of latitude */
+    double  nyofs;      /* row of the equator */
+    int     yofs;       /* fixed-point row of the equator */
+    int     alpha;      /* use alpha blending (else screen)? */
+    int     loaded;     /* file loaded (texels or not)? */
+    FileStamp stamp;    /* the file when it was loaded */
+    struct texture *coarser; /* half-size copy (NULL if none) */
+} Texture;
 
 static int image_type _P((FILE *));
+static Texture *slot_texture _P((int));
+static const char *slot_file _P((int));
+static void get_stamp _P((struct stat *, FileStamp *));
+static int same_stamp _P((FileStamp *, FileStamp *));
+static void update_texture _P((const char *, Texture *));
+static void load_texture _P((const char *, Texture *));
+static gdImagePtr read_gd _P((FILE *, int, const char *));
+static void load_tiled _P((const char *, Texture *));
+static int tiled_ok _P((TexBinHeader *, long));
+static u8or32 tile_texel _P((Texture *, int, int));
+static u8or32 *read_tile _P((Texture *, int));
+static void set_scales _P((Texture *));
+static void build_mipmaps _P((Texture *));
+static u8or32 tex_average _P((u8or32, u8or32, u8or32, u8or32));
+static void free_texture _P((Texture *));
+static Texture *pick_level _P((Texture *));
+static int join_group _P((Texture *));
+static void coord_nearest _P((Texture *, double, double, TexCoord *));
+static int fetch_nearest _P((Texture *, TexCoord *, u8or32 *));
+static void coord_bilinear _P((Texture *, double, double, TexCoord *));
+static int fetch_bilinear _P((Texture *, TexCoord *, u8or32 *));
+static u8or32 tex_lerp _P((u8or32, u8or32, int));
+
+static Texture map;
+static gdImagePtr gd_map = NULL;          /* see gd_map_open() */
+static Texture overlay[MAX_OVERLAY];
+static Texture *map_level;                /* what to sample this frame */
+static Texture *overlay_level[MAX_OVERLAY];
+static Texture *group_tex[MAX_OVERLAY+1]; /* one of each size in use */
+static int ngroups;
+static int map_group;                     /* map_level's size */
+static int overlay_group[MAX_OVERLAY];
+static void (*coord) _P((Texture *, double, double, TexCoord *));
+static int (*fetch) _P((Texture *, TexCoord *, u8or32 *));
+
+#ifdef TEX_WATCH
+static void start_watch _P((void));
+static void *watch_main _P((void *));
+static void watch_reload _P((int, int));
+static void swap_fresh _P((void));
 
-static gdImagePtr map;
-static gdImagePtr overlay[MAX_OVERLAY];
-static int overlay_alpha[MAX_OVERLAY];
+/* textures are numbered as "slots": 0 for the map, then overlays */
+static pthread_mutex_t fresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static Texture   fresh[MAX_OVERLAY+1];    /* reloaded, not swapped in yet */
+static int       fresh_ok[MAX_OVERLAY+1]; /* anything in fresh[]? */
+static FileStamp known[MAX_OVERLAY+1];    /* newest version loaded */
+static int       known_ok[MAX_OVERLAY+1]; /* anything in known[]? */
+static int       watch_wd[MAX_OVERLAY+1]; /* watch on file's directory */
+static const char *watch_name[MAX_OVERLAY+1]; /* file within it */
+static int       watch_fd;
+static int       watch_tried = 0;         /* start_watch() called? */
+static int       watching = 0;            /* watcher thread running? */
+#endif
 
+/* get the map and overlays ready for render(). the first time
+ * around, load them all; after that, if the watcher thread is
+ * running, just swap in whatever it has reloaded since the last
+ * frame, else reload files that have changed (which render() then
+ * waits for). then pick the size of each to use at this scale, and
+ * group those by size (see tex_groups()).
+ */
 void overlay_init()
 {
-    FILE *f;
     int i;
-    int x;
-
-    if (mapfile != NULL) {
-        f = fopen(mapfile, "rb");
-        if (f != NULL) {
-            switch (image_type(f)) {
-            case ImageGif:
-                map = gdImageCreateFromGif(f);
-                break;
-            case ImagePng:
-                map = gdImageCreateFromPng(f);
-                break;
-            case ImageJpeg:
-                map = gdImageCreateFromJpeg(f);
-                break;
-            default:
-                fprintf(stderr, "xearth: warning: unknown image file format: %s\n", mapfile);
-                map = NULL;
-                break;
+
+    coord = do_bilinear ? coord_bilinear : coord_nearest;
+    fetch = do_bilinear ? fetch_bilinear : fetch_nearest;
+
+#ifdef TEX_WATCH
+    if (watching) {
+        swap_fresh();
+    } else
+#endif
+    {
+        for (i = 0; i <= overlay_count; i++) {
+            if (slot_file(i) != NULL) {
+                update_texture(slot_file(i), slot_texture(i));
             }
-            fclose(f);
-        } else {
-            fprintf(stderr, "xearth: warning: file not found: %s\n", mapfile);
         }
+#ifdef TEX_WATCH
+        if (!watch_tried) {
+            watch_tried = 1;
+            start_watch();
+        }
+#endif
     }
+
+    ngroups = 0;
+    map_level = pick_level(&map);
+    map_group = join_group(map_level);
     for (i = 0; i < overlay_count; i++) {
-        f = fopen(overlayfile[i], "rb");
-        if (f != NULL) {
-            switch (image_type(f)) {
-            case ImageGif:
-                overlay[i] = gdImageCreateFromGif(f);
-                break;
-            case ImagePng:
-                overlay[i] = gdImageCreateFromPng(f);
-                break;
-            case ImageJpeg:
-                overlay[i] = gdImageCreateFromJpeg(f);
-                break;
-            default:
-                fprintf(stderr, "xearth: warning: unknown image file format: %s\n", overlayfile[i]);
-                break;
-            }
-            fclose(f);
-            overlay_alpha[i] = 0;
-            for (x = 0; x < gdImageSX(overlay[i]); x++) {
-                if (gdImageAlpha(overlay[i], gdImageGetPixel(overlay[i], x, gdImageSY(overlay[i]) / 2)) != 0) {
-                    overlay_alpha[i] = 1;
-                    break;
-                }
-            }
-        } else {
-            fprintf(stderr, "xearth: warning: file not found: %s\n", overlayfile[i]);
-        }
+        overlay_level[i] = pick_level(&overlay[i]);
+        overlay_group[i] = join_group(overlay_level[i]);
     }
 }
 
-int map_pixel(double lat, double lon)
+/* the sizes of the textures picked for this frame, as (sx, sy) pairs
+ * in sizes[]; returns how many there are. every texture of the same
+ * size shares the same TexCoord for a pixel, so render() needs one
+ * TexCoord per size for each pixel, in this order.
+ */
+int tex_groups(int *sizes)
 {
-    int x, y;
-    double r;
-    int c;
+    int g;
 
-    if (map == NULL) {
-        return -1;
+    for (g = 0; g < ngroups; g++) {
+        sizes[2*g] = group_tex[g]->sx;
+        sizes[2*g+1] = group_tex[g]->sy;
     }
-    x = (int) ((lon + M_PI) * gdImageSX(map) / (2*M_PI));
-    r = 1.0; /* gdImageSX(map) / (gdImageSY(map) * 2.0); */
-    y = (int) (-lat * gdImageSY(map) / M_PI * r + gdImageSY(map)/2);
-    /* handle minor rounding errors */
-    if (x == -1) x++;
-    if (x == gdImageSX(map)) x--;
-    if (y == -1) y++;
-    if (y == gdImageSY(map)) y--;
-    if (x < 0 || x >= gdImageSX(map) || y < 0 || y >= gdImageSY(map)) {
+    return ngroups;
+}
+
+/* work out where (lat, lon) lands on the textures of each size,
+ * filling in a TexCoord for each (see tex_groups())
+ */
+void tex_coord(double lat, double lon, TexCoord *c)
+{
+    int g;
+
+    for (g = 0; g < ngroups; g++) {
+        coord(group_tex[g], lat, lon, &c[g]);
+    }
+}
+
+/* c holds a pixel's TexCoords, as filled in by tex_coord()
+ */
+int map_pixel(TexCoord *c)
+{
+    u8or32 t;
+
+    if (map_group < 0 || !fetch(map_level, &c[map_group], &t)) {
         return -1;
     }
-    c = gdImageGetPixel(map, x, y);
-    return PixRGB(gdImageRed(map, c), gdImageGreen(map, c), gdImageBlue(map, c));
+    return PixRGB(TexRed(t), TexGreen(t), TexBlue(t));
 }
 
-int overlay_pixel(double lat, double lon, int p)
+int overlay_pixel(TexCoord *c, int p)
 {
-    int i, x, y;
-    gdImagePtr ov;
+    int i;
+    u8or32 t;
 
     for (i = 0; i < overlay_count; i++) {
-        ov = overlay[i];
-        if (ov == NULL) {
-            continue;
-        }
-        x = (int) ((lon + M_PI) * gdImageSX(ov) / (2*M_PI));
-        y = (int) (-lat * gdImageSY(ov) / M_PI + gdImageSY(ov)/2);
-        /* handle minor rounding errors */
-        if (x == -1) x++;
-        if (x == gdImageSX(ov)) x--;
-        if (y == -1) y++;
-        if (y == gdImageSY(ov)) y--;
-        if (x >= 0 && x < gdImageSX(ov) && y >= 0 && y < gdImageSY(ov)) {
-            int c = gdImageGetPixel(ov, x, y);
+        if (overlay_group[i] >= 0 &&
+            fetch(overlay_level[i], &c[overlay_group[i]], &t)) {
             int r = PixRed(p);
             int g = PixGreen(p);
             int b = PixBlue(p);
-            if (overlay_alpha[i]) {
-                int a = gdImageAlpha(ov, c);
+            if (overlay[i].alpha) {
+                int a = TexAlpha(t);
                 p = PixRGB(
-                    a * r / 127 + (127 - a) * gdImageRed(ov, c) / 127,
-                    a * g / 127 + (127 - a) * gdImageGreen(ov, c) / 127,
-                    a * b / 127 + (127 - a) * gdImageBlue(ov, c) / 127
+                    a * r / 127 + (127 - a) * TexRed(t) / 127,
+                    a * g / 127 + (127 - a) * TexGreen(t) / 127,
+                    a * b / 127 + (127 - a) * TexBlue(t) / 127
                 );
             } else {
                 p = PixRGB(
-                    r + gdImageRed(ov, c) * (255 - r) / 255,
-                    g + gdImageGreen(ov, c) * (255 - g) / 255,
-                    b + gdImageBlue(ov, c) * (255 - b) / 255
+                    r + TexRed(t) * (255 - r) / 255,
+                    g + TexGreen(t) * (255 - g) / 255,
+                    b + TexBlue(t) * (255 - b) / 255
                 );
             }
         }
@@ -138,20 +284,787 @@ int overlay_pixel(double lat, double lon, int p)
     return p;
 }
 
-void overlay_close()
+/* give tex the group for its size, starting a new one if it's the
+ * first of that size (-1 if it has no texels)
+ */
+static int join_group(Texture *tex)
+{
+    int g;
+
+    if (tex->texels == NULL && tex->tiles == NULL) {
+        return -1;
+    }
+    for (g = 0; g < ngroups; g++) {
+        if (group_tex[g]->sx == tex->sx && group_tex[g]->sy == tex->sy) {
+            return g;
+        }
+    }
+    group_tex[ngroups] = tex;
+    return ngroups++;
+}
+
+/* the texel (lat, lon) lands on, as (x, y) in c, or TEX_NONE if there
+ * isn't one. this has to come out exactly the way gd_map_pixel() does
+ * it, since pixel centers often land right on the edges between
+ * texels and any other rounding moves them into the next one. so
+ * multiply by nxscale and nyscale, and only when that lands within
+ * NEAREST_EPS of an edge (or off the texture) work it out again
+ * dividing, the way gd does.
+ */
+static void coord_nearest(Texture *tex, double lat, double lon, TexCoord *c)
+{
+    int    x, y;
+    double tx, ty;
+
+    tx = (lon + M_PI) * tex->nxscale;
+    ty = tex->nyofs - lat * tex->nyscale;
+    x = (int) tx;
+    y = (int) ty;
+    if (fabs(tx - x - 0.5) > 0.5 - NEAREST_EPS ||
+        fabs(ty - y - 0.5) > 0.5 - NEAREST_EPS ||
+        (unsigned) x >= (unsigned) tex->sx ||
+        (unsigned) y >= (unsigned) tex->sy) {
+        x = (int) ((lon + M_PI) * tex->sx / (2*M_PI));
+        y = (int) (-lat * tex->sy / M_PI + tex->sy / 2);
+        /* handle minor rounding errors */
+        if (x == -1) x++;
+        if (x == tex->sx) x--;
+        if (y == -1) y++;
+        if (y == tex->sy) y--;
+        if (x < 0 || x >= tex->sx || y < 0 || y >= tex->sy) {
+            c->u = TEX_NONE;
+            return;
+        }
+    }
+    c->u = x;
+    c->v = y;
+}
+
+static int fetch_nearest(Texture *tex, TexCoord *c, u8or32 *rslt)
+{
+    if (c->u == TEX_NONE) {
+        return 0;
+    }
+    *rslt = TexAt(tex, c->u, c->v);
+    return 1;
+}
+
+/* like coord_nearest(), but (lat, lon) in fixed point, measured from
+ * the centers of the texels
+ */
+static void coord_bilinear(Texture *tex, double lat, double lon, TexCoord *c)
+{
+    int u, v;
+
+    u = ((int) ((lon + M_PI) * tex->xscale)) - TEX_ONE / 2;
+    v = ((int) (tex->yofs - lat * tex->yscale)) - TEX_ONE / 2;
+    if ((u >> TEX_SHIFT) < -1 || (u >> TEX_SHIFT) >= tex->sx ||
+        (v >> TEX_SHIFT) < -1 || (v >> TEX_SHIFT) >= tex->sy) {
+        c->u = TEX_NONE;
+        return;
+    }
+    c->u = u;
+    c->v = v;
+}
+
+/* blend the four texels around c; they wrap around in longitude and
+ * stop at the poles
+ */
+static int fetch_bilinear(Texture *tex, TexCoord *c, u8or32 *rslt)
+{
+    int x0, x1, y0, y1;
+
+    if (c->u == TEX_NONE) {
+        return 0;
+    }
+    x0 = c->u >> TEX_SHIFT;
+    y0 = c->v >> TEX_SHIFT;
+    x1 = x0 + 1;
+    y1 = y0 + 1;
+    if (x0 < 0) x0 += tex->sx;
+    if (x1 >= tex->sx) x1 -= tex->sx;
+    if (y0 < 0) y0 = 0;
+    if (y1 >= tex->sy) y1 = tex->sy - 1;
+
+    *rslt = tex_lerp(tex_lerp(TexAt(tex, x0, y0), TexAt(tex, x1, y0),
+                              c->u & (TEX_ONE - 1)),
+                     tex_lerp(TexAt(tex, x0, y1), TexAt(tex, x1, y1),
+                              c->u & (TEX_ONE - 1)),
+                     c->v & (TEX_ONE - 1));
+    return 1;
+}
+
+/* blend texels a and b, f/TEX_ONE of the way from a to b; does two
+ * bytes of each at a time (each product fits in 16 bits)
+ */
+static u8or32 tex_lerp(u8or32 a, u8or32 b, int f)
+{
+    u8or32 lo, hi;
+
+    lo = ((a & 0x00ff00ff) * (TEX_ONE - f) + (b & 0x00ff00ff) * f) >> TEX_SHIFT;
+    hi = (((a >> 8) & 0x00ff00ff) * (TEX_ONE - f) +
+          ((b >> 8) & 0x00ff00ff) * f) >> TEX_SHIFT;
+    return (lo & 0x00ff00ff) | ((hi & 0x00ff00ff) << 8);
+}
+
+static Texture *slot_texture(int i)
+{
+    return (i == 0) ? &map : &overlay[i - 1];
+}
+
+static const char *slot_file(int i)
+{
+    return (i == 0) ? mapfile : overlayfile[i - 1];
+}
+
+static void get_stamp(struct stat *st, FileStamp *stamp)
+{
+    stamp->mtime = st->st_mtime;
+    stamp->size = st->st_size;
+    stamp->dev = st->st_dev;
+    stamp->ino = st->st_ino;
+}
+
+static int same_stamp(FileStamp *a, FileStamp *b)
+{
+    return (a->mtime == b->mtime && a->size == b->size &&
+            a->dev == b->dev && a->ino == b->ino);
+}
+
+/* reload tex from file unless it was loaded from there before and
+ * the file's modification time, size and inode are all unchanged
+ * (and, for a tiled texture file, read_tile() hasn't seen it change
+ * in the meantime, as when it gets rewritten in place within a
+ * second of the last time)
+ */
+static void update_texture(const char *file, Texture *tex)
+{
+    struct stat st;
+    FileStamp stamp;
+
+    if (stat(file, &st) != 0) {
+        free_texture(tex);
+        tex->loaded = 0;
+        fprintf(stderr, "xearth: warning: file not found: %s\n", file);
+        return;
+    }
+    get_stamp(&st, &stamp);
+    if (tex->loaded && same_stamp(&stamp, &tex->stamp) &&
+        (tex->file == NULL || !tex->file->changed)) {
+        return;
+    }
+    if (tex->loaded && verbose) {
+        fprintf(stderr, "xearth: %s changed, reloading\n", file);
+    }
+
+    free_texture(tex);
+    load_texture(file, tex);
+    tex->loaded = 1;
+    tex->stamp = stamp;
+}
+
+#ifdef TEX_WATCH
+
+/* start a thread that watches the directories holding the map and
+ * overlay files for files being written or moved into place, and
+ * decodes the new versions of ours as they show up, so render()
+ * never has to wait for that. if anything goes wrong, overlay_init()
+ * just keeps checking the files itself.
+ */
+static void start_watch()
 {
     int i;
+    const char *file;
+    const char *slash;
+    char *dir;
+    pthread_t thread;
 
-    if (map != NULL) {
-        gdImageDestroy(map);
+    if (mapfile == NULL && overlay_count == 0) {
+        return;
     }
-    map = NULL;
-    for (i = 0; i < overlay_count; i++) {
-        if (overlay[i] != NULL) {
-            gdImageDestroy(overlay[i]);
+    watch_fd = inotify_init();
+    if (watch_fd < 0) {
+        return;
+    }
+
+    for (i = 0; i <= overlay_count; i++) {
+        watch_name[i] = NULL;
+        file = slot_file(i);
+        if (file == NULL) {
+            continue;
+        }
+
+        /* watch the directory rather than the file itself, so that
+         * files replaced by renaming a new one over them get noticed */
+        slash = strrchr(file, '/');
+        if (slash == NULL) {
+            dir = (char *) malloc(2);
+            assert(dir != NULL);
+            strcpy(dir, ".");
+            watch_name[i] = file;
+        } else {
+            dir = (char *) malloc(slash - file + 2);
+            assert(dir != NULL);
+            memcpy(dir, file, slash - file + 1);
+            dir[(slash == file) ? 1 : (slash - file)] = '\0';
+            watch_name[i] = slash + 1;
+        }
+        watch_wd[i] = inotify_add_watch(watch_fd, dir,
+                                        IN_CLOSE_WRITE | IN_MOVED_TO |
+                                        IN_ATTRIB);
+        free(dir);
+        if (watch_wd[i] < 0) {
+            close(watch_fd);
+            return;
+        }
+
+        known[i] = slot_texture(i)->stamp;
+        known_ok[i] = slot_texture(i)->loaded;
+        fresh_ok[i] = 0;
+    }
+
+    if (pthread_create(&thread, NULL, watch_main, NULL) != 0) {
+        close(watch_fd);
+        return;
+    }
+    pthread_detach(thread);
+    watching = 1;
+}
+
+/* watcher thread main loop
+ */
+static void *watch_main(void *arg)
+{
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } u;
+    struct inotify_event *ev;
+    char *p;
+    int n, i;
+    int changed[MAX_OVERLAY+1];
+
+    for (;;) {
+        n = read(watch_fd, u.buf, sizeof(u.buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+
+        /* a file often shows up more than once in a batch; only
+         * reload it once (changed[] is 2 if it was written) */
+        for (i = 0; i <= overlay_count; i++) {
+            changed[i] = 0;
+        }
+        for (p = u.buf; p < u.buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (struct inotify_event *) p;
+            if (ev->len == 0) {
+                continue;
+            }
+            for (i = 0; i <= overlay_count; i++) {
+                if (watch_name[i] != NULL && ev->wd == watch_wd[i] &&
+                    strcmp(ev->name, watch_name[i]) == 0) {
+                    if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                        changed[i] = 2;
+                    } else if (changed[i] == 0) {
+                        changed[i] = 1;
+                    }
+                }
+            }
+        }
+        for (i = 0; i <= overlay_count; i++) {
+            if (changed[i]) {
+                watch_reload(i, changed[i] == 2);
+            }
         }
-        overlay[i] = NULL;
     }
+    return arg;
+}
+
+/* (watcher thread) decode slot i's file if it was written (a file
+ * rewritten in place within a second of the last time looks the same
+ * to stat()) or really has changed, and leave it for swap_fresh()
+ */
+static void watch_reload(int i, int written)
+{
+    const char *file;
+    struct stat st;
+    FileStamp stamp;
+    Texture tex;
+
+    file = slot_file(i);
+    if (stat(file, &st) != 0) {
+        return;
+    }
+    get_stamp(&st, &stamp);
+    if (!written && known_ok[i] && same_stamp(&stamp, &known[i])) {
+        return;
+    }
+    known[i] = stamp;
+    known_ok[i] = 1;
+
+    load_texture(file, &tex);
+    tex.loaded = 1;
+    tex.stamp = stamp;
+
+    pthread_mutex_lock(&fresh_lock);
+    if (fresh_ok[i]) {
+        free_texture(&fresh[i]);
+    }
+    fresh[i] = tex;
+    fresh_ok[i] = 1;
+    pthread_mutex_unlock(&fresh_lock);
+
+    if (verbose) {
+        fprintf(stderr, "xearth: %s changed, reloaded in background\n", file);
+    }
+}
+
+/* (between frames) replace textures with any newer versions the
+ * watcher thread has loaded
+ */
+static void swap_fresh()
+{
+    int i;
+
+    pthread_mutex_lock(&fresh_lock);
+    for (i = 0; i <= overlay_count; i++) {
+        if (fresh_ok[i]) {
+            free_texture(slot_texture(i));
+            *slot_texture(i) = fresh[i];
+            fresh_ok[i] = 0;
+        }
+    }
+    pthread_mutex_unlock(&fresh_lock);
+}
+
+#endif /* TEX_WATCH */
+
+/* read an image file and convert it to a texture (with no texels if
+ * that doesn't work out)
+ */
+static void load_texture(const char *file, Texture *tex)
+{
+    FILE *f;
+    gdImagePtr im;
+    int x, y, c, type;
+    u8or32 *t;
+
+    tex->texels = NULL;
+    tex->tile_shift = 0;
+    tex->tiles = NULL;
+    tex->file = NULL;
+    tex->coarser = NULL;
+    f = fopen(file, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "xearth: warning: file not found: %s\n", file);
+        return;
+    }
+    type = image_type(f);
+    if (type == ImageTiled) {
+        fclose(f);
+        load_tiled(file, tex);
+        return;
+    }
+    im = read_gd(f, type, file);
+    fclose(f);
+    if (im == NULL) {
+        return;
+    }
+    if (gdImageSX(im) >= TEX_MAX_SIZE || gdImageSY(im) >= TEX_MAX_SIZE) {
+        fprintf(stderr, "xearth: warning: image too large: %s\n", file);
+        gdImageDestroy(im);
+        return;
+    }
+
+    tex->sx = gdImageSX(im);
+    tex->sy = gdImageSY(im);
+    set_scales(tex);
+    tex->texels = (u8or32 *) malloc(sizeof(u8or32) * tex->sx * tex->sy);
+    assert(tex->texels != NULL);
+
+    t = tex->texels;
+    for (y = 0; y < tex->sy; y++) {
+        for (x = 0; x < tex->sx; x++) {
+            c = gdImageGetPixel(im, x, y);
+            *t++ = TexRGBA(gdImageRed(im, c), gdImageGreen(im, c),
+                           gdImageBlue(im, c), gdImageAlpha(im, c));
+        }
+    }
+    gdImageDestroy(im);
+
+    /* blend by alpha if there is any across the middle row */
+    tex->alpha = 0;
+    t = tex->texels + (tex->sy / 2) * tex->sx;
+    for (x = 0; x < tex->sx; x++) {
+        if (TexAlpha(t[x]) != 0) {
+            tex->alpha = 1;
+            break;
+        }
+    }
+
+    build_mipmaps(tex);
+}
+
+/* decode an image file of the given type with gd
+ */
+static gdImagePtr read_gd(FILE *f, int type, const char *file)
+{
+    switch (type) {
+    case ImageGif:
+        return gdImageCreateFromGif(f);
+    case ImagePng:
+        return gdImageCreateFromPng(f);
+    case ImageJpeg:
+        return gdImageCreateFromJpeg(f);
+    default:
+        fprintf(stderr, "xearth: warning: unknown image file format: %s\n", file);
+        return NULL;
+    }
+}
+
+/* open a tiled texture file (made by img2tex; see TexBinHeader in
+ * xearth.h) and set up tex, and a chain of copies for the rest of the
+ * levels in the file, to read tiles from it. nothing more is read
+ * until it gets sampled, so only the tiles a view uses take up
+ * memory.
+ */
+static void load_tiled(const char *file, Texture *tex)
+{
+    int fd;
+    struct stat st;
+    TexBinHeader hdr;
+    TileFile *tf;
+    int i, n;
+    TexBinLevel *lvl;
+    Texture *t;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "xearth: warning: unable to read tiled texture: %s\n", file);
+        return;
+    }
+    if (fstat(fd, &st) != 0 ||
+        read(fd, (char *) &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        !tiled_ok(&hdr, (long) st.st_size)) {
+        fprintf(stderr, "xearth: warning: bad tiled texture file: %s\n", file);
+        close(fd);
+        return;
+    }
+
+    tf = (TileFile *) malloc(sizeof(TileFile));
+    assert(tf != NULL);
+    tf->fd = fd;
+    get_stamp(&st, &tf->stamp);
+    tf->changed = 0;
+    tf->tile_bytes = (long) sizeof(u8or32) << (2 * hdr.tile_shift);
+    tf->blank = (u8or32 *) calloc(1, tf->tile_bytes);
+    assert(tf->blank != NULL);
+#ifndef NO_PTHREADS
+    pthread_mutex_init(&tf->lock, NULL);
+#endif
+
+    t = tex;
+    for (i = 0; i < hdr.nlevels; i++) {
+        lvl = &hdr.level[i];
+        if (i > 0) {
+            t->coarser = (Texture *) malloc(sizeof(Texture));
+            assert(t->coarser != NULL);
+            t = t->coarser;
+            t->loaded = 1;
+            t->coarser = NULL;
+        }
+        n = lvl->tiles_x * lvl->tiles_y;
+        t->tiles = (u8or32 **) malloc(sizeof(u8or32 *) * n);
+        assert(t->tiles != NULL);
+        memset(t->tiles, 0, sizeof(u8or32 *) * n);
+        t->tiles_ofs = hdr.tile_ofs + lvl->first_tile * tf->tile_bytes;
+        t->file = tf;
+        t->sx = lvl->sx;
+        t->sy = lvl->sy;
+        t->tile_shift = hdr.tile_shift;
+        t->tile_mask = (1 << hdr.tile_shift) - 1;
+        t->tiles_x = lvl->tiles_x;
+        t->alpha = hdr.alpha;
+        set_scales(t);
+    }
+}
+
+/* the texel at (x, y) of a tiled texture, reading in its tile if
+ * that hasn't happened yet
+ */
+static u8or32 tile_texel(Texture *tex, int x, int y)
+{
+    int i;
+    u8or32 *tile;
+
+    i = (y >> tex->tile_shift) * tex->tiles_x + (x >> tex->tile_shift);
+    tile = TileGet(tex->tiles[i]);
+    if (tile == NULL) {
+        tile = read_tile(tex, i);
+    }
+    return tile[((y & tex->tile_mask) << tex->tile_shift) +
+                (x & tex->tile_mask)];
+}
+
+/* read tile i of tex in from its file, unless some other thread just
+ * has. if the file has changed since it was opened (it's being
+ * rewritten in place, say), the tile comes out blank instead, since
+ * it could well be half written; the file gets reloaded once
+ * overlay_init() or the watcher thread notices the change.
+ */
+static u8or32 *read_tile(Texture *tex, int i)
+{
+    TileFile *tf;
+    struct stat st;
+    FileStamp stamp;
+    u8or32 *tile;
+    long n;
+
+    tf = tex->file;
+#ifndef NO_PTHREADS
+    pthread_mutex_lock(&tf->lock);
+#endif
+    tile = tex->tiles[i];
+    if (tile == NULL) {
+        tile = tf->blank;
+        if (fstat(tf->fd, &st) == 0) {
+            get_stamp(&st, &stamp);
+            tf->changed = !same_stamp(&stamp, &tf->stamp);
+            if (!tf->changed) {
+                tile = (u8or32 *) malloc(tf->tile_bytes);
+                assert(tile != NULL);
+                n = -1;
+                if (lseek(tf->fd, tex->tiles_ofs + i * tf->tile_bytes,
+                          SEEK_SET) >= 0) {
+                    n = read(tf->fd, (char *) tile, tf->tile_bytes);
+                }
+                if (n != tf->tile_bytes) {
+                    free(tile);
+                    tile = tf->blank;
+                }
+            }
+        }
+        TileSet(tex->tiles[i], tile);
+    }
+#ifndef NO_PTHREADS
+    pthread_mutex_unlock(&tf->lock);
+#endif
+    return tile;
+}
+
+/* does hdr describe a tiled texture file of size bytes that this
+ * machine can use?
+ */
+static int tiled_ok(TexBinHeader *hdr, long size)
+{
+    int i;
+    int tile;
+    double tiles;
+    TexBinLevel *lvl;
+
+    if (size < (long) sizeof(TexBinHeader) ||
+        memcmp(hdr->magic, TexBinMagic, sizeof(hdr->magic)) != 0 ||
+        hdr->byte_order != MapBinByteOrder ||
+        hdr->header_size != sizeof(TexBinHeader) ||
+        hdr->version != TexBinVersion ||
+        hdr->tile_shift < TexBinMinShift || hdr->tile_shift > TexBinMaxShift ||
+        hdr->nlevels < 1 || hdr->nlevels > TexBinMaxLevels ||
+        hdr->tile_ofs < hdr->header_size ||
+        hdr->tile_ofs % TexBinAlign != 0) {
+        return 0;
+    }
+
+    tile = 1 << hdr->tile_shift;
+    for (i = 0; i < hdr->nlevels; i++) {
+        lvl = &hdr->level[i];
+        if (lvl->sx <= 0 || lvl->sx >= TEX_MAX_SIZE ||
+            lvl->sy <= 0 || lvl->sy >= TEX_MAX_SIZE ||
+            lvl->tiles_x != (lvl->sx + tile - 1) / tile ||
+            lvl->tiles_y != (lvl->sy + tile - 1) / tile ||
+            lvl->first_tile < 0) {
+            return 0;
+        }
+        /* texel indices within a level have to fit in an int, and
+         * the tiles in the file */
+        tiles = (double) lvl->tiles_x * lvl->tiles_y;
+        if (tiles * tile * tile > INT_MAX ||
+            hdr->tile_ofs + (lvl->first_tile + tiles) * tile * tile *
+            sizeof(u8or32) > size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* the scales coord_nearest() and (in fixed point) coord_bilinear() use
+ */
+static void set_scales(Texture *tex)
+{
+    tex->xscale = tex->sx * (double) TEX_ONE / (2*M_PI);
+    tex->yscale = tex->sy * (double) TEX_ONE / M_PI;
+    tex->nxscale = tex->sx / (2*M_PI);
+    tex->nyscale = tex->sy / M_PI;
+    tex->nyofs = tex->sy / 2;
+    tex->yofs = (tex->sy / 2) * TEX_ONE;
+}
+
+/* give tex a chain of copies, each half the size of the one before
+ * (averaging 2x2 blocks of texels; an odd last row or column is
+ * dropped), down to a couple of texels across
+ */
+static void build_mipmaps(Texture *tex)
+{
+    Texture *fine, *c;
+    u8or32 *t, *r0, *r1;
+    int x, y;
+
+    for (fine = tex; fine->sx >= 4 && fine->sy >= 4; fine = c) {
+        c = (Texture *) malloc(sizeof(Texture));
+        assert(c != NULL);
+        c->sx = fine->sx / 2;
+        c->sy = fine->sy / 2;
+        set_scales(c);
+        c->tile_shift = 0;
+        c->tiles = NULL;
+        c->file = NULL;
+        c->alpha = fine->alpha;
+        c->loaded = 1;
+        c->coarser = NULL;
+        c->texels = (u8or32 *) malloc(sizeof(u8or32) * c->sx * c->sy);
+        assert(c->texels != NULL);
+
+        t = c->texels;
+        for (y = 0; y < c->sy; y++) {
+            r0 = fine->texels + (2 * y) * fine->sx;
+            r1 = r0 + fine->sx;
+            for (x = 0; x < c->sx; x++) {
+                *t++ = tex_average(r0[2*x], r0[2*x+1], r1[2*x], r1[2*x+1]);
+            }
+        }
+        fine->coarser = c;
+    }
+}
+
+/* average four texels, two bytes of each at a time (like tex_lerp())
+ */
+static u8or32 tex_average(u8or32 a, u8or32 b, u8or32 c, u8or32 d)
+{
+    u8or32 lo, hi;
+
+    lo = ((a & 0x00ff00ff) + (b & 0x00ff00ff) +
+          (c & 0x00ff00ff) + (d & 0x00ff00ff) + 0x00020002) >> 2;
+    hi = (((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) +
+          ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff) +
+          0x00020002) >> 2;
+    return (lo & 0x00ff00ff) | ((hi & 0x00ff00ff) << 8);
+}
+
+static void free_texture(Texture *tex)
+{
+    Texture *t, *next;
+    TileFile *tf;
+    int i, n;
+
+    tf = tex->file;
+    for (t = tex; t != NULL; t = next) {
+        next = t->coarser;
+        if (t->tiles != NULL) {
+            n = ((t->sx + t->tile_mask) >> t->tile_shift) *
+                ((t->sy + t->tile_mask) >> t->tile_shift);
+            for (i = 0; i < n; i++) {
+                if (t->tiles[i] != tf->blank) {
+                    free(t->tiles[i]);
+                }
+            }
+            free(t->tiles);
+        } else if (t->texels != NULL) {
+            free(t->texels);
+        }
+        if (t != tex) {
+            free(t);
+        }
+    }
+    if (tf != NULL) {
+        close(tf->fd);
+        free(tf->blank);
+#ifndef NO_PTHREADS
+        pthread_mutex_destroy(&tf->lock);
+#endif
+        free(tf);
+    }
+    tex->texels = NULL;
+    tex->tiles = NULL;
+    tex->file = NULL;
+    tex->coarser = NULL;
+}
+
+/* the smallest copy of tex that still has a texel for every pixel
+ * where the projection is at its largest (the middle of the globe,
+ * or the equator), so that small views of big images neither read
+ * texels all over memory nor alias. proj_scale is pixels per radian
+ * there; a texel is 2*pi/sx radians wide and pi/sy radians high.
+ */
+static Texture *pick_level(Texture *tex)
+{
+    double px;
+
+    px = 2*M_PI * proj_info.proj_scale;
+    while ((tex->coarser != NULL) &&
+           (tex->coarser->sx >= px) && (2 * tex->coarser->sy >= px)) {
+        tex = tex->coarser;
+    }
+    return tex;
+}
+
+/* (for -bench) decode the map file with gd, for gd_map_pixel(), the
+ * way xearth used to every time; returns 0 if that doesn't work out
+ * (a tiled texture file, say)
+ */
+int gd_map_open()
+{
+    FILE *f;
+    int type;
+
+    f = fopen(mapfile, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    type = image_type(f);
+    gd_map = (type == ImageTiled) ? NULL : read_gd(f, type, mapfile);
+    fclose(f);
+    return (gd_map != NULL);
+}
+
+/* the pixel of the map at (lat, lon) (or -1 if none), looked up
+ * through gd the way map_pixel() used to before textures
+ */
+int gd_map_pixel(double lat, double lon)
+{
+    int x, y;
+    int c;
+
+    x = (int) ((lon + M_PI) * gdImageSX(gd_map) / (2*M_PI));
+    y = (int) (-lat * gdImageSY(gd_map) / M_PI + gdImageSY(gd_map)/2);
+    /* handle minor rounding errors */
+    if (x == -1) x++;
+    if (x == gdImageSX(gd_map)) x--;
+    if (y == -1) y++;
+    if (y == gdImageSY(gd_map)) y--;
+    if (x < 0 || x >= gdImageSX(gd_map) || y < 0 || y >= gdImageSY(gd_map)) {
+        return -1;
+    }
+    c = gdImageGetPixel(gd_map, x, y);
+    return PixRGB(gdImageRed(gd_map, c), gdImageGreen(gd_map, c),
+                  gdImageBlue(gd_map, c));
+}
+
+void gd_map_close()
+{
+    gdImageDestroy(gd_map);
+    gd_map = NULL;
 }
 
 static int image_type(f)
@@ -173,6 +1086,10 @@ static int image_type(f)
   {
     r = ImageJpeg;
   }
+  else if (memcmp(buf, TexBinMagic, 8) == 0)
+  {
+    r = ImageTiled;
+  }
   fseek(f, 0, SEEK_SET);
 
   return r;
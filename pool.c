@@ -0,0 +1,310 @@
+/*
+ * pool.c
+ * worker thread pool
+ *
+ * Copyright (C) 1989, 1990, 1993-1995, 1999 Kirk Lauritz Johnson
+ *
+ * Parts of the source code (as marked) are:
+ *   Copyright (C) 1989, 1990, 1991 by Jim Frost
+ *   Copyright (C) 1992 by Jamie Zawinski <jwz@lucid.com>
+ *
+ * Permission to use, copy, modify and freely distribute xearth for
+ * non-commercial and not-for-profit purposes is hereby granted
+ * without fee, provided that both the above copyright notice and this
+ * permission notice appear in all copies and in supporting
+ * documentation.
+ *
+ * Unisys Corporation holds worldwide patent rights on the Lempel Zev
+ * Welch (LZW) compression technique employed in the CompuServe GIF
+ * image file format as well as in other formats. Unisys has made it
+ * clear, however, that it does not require licensing or fees to be
+ * paid for freely distributed, non-commercial applications (such as
+ * xearth) that employ LZW/GIF technology. Those wishing further
+ * information about licensing the LZW patent should contact Unisys
+ * directly at (lzw_info@unisys.com) or by writing to
+ *
+ *   Unisys Corporation
+ *   Welch Licensing Department
+ *   M/S-C1SW19
+ *   P.O. Box 500
+ *   Blue Bell, PA 19424
+ *
+ * The author makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS,
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "xearth.h"
+#include "kljcpyrt.h"
+
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif /* !NO_PTHREADS */
+
+/* each worker of a pool_run() job has a share of the items handed
+ * out by pool_deal(): it takes items from the front of its own share
+ * and, once that runs out, steals the back half of whichever share
+ * has the most left
+ */
+typedef struct
+{
+  int             next;         /* next item to take           */
+  int             end;          /* one past the last item      */
+#ifndef NO_PTHREADS
+  pthread_mutex_t lock;         /* guards next and end         */
+#endif /* !NO_PTHREADS */
+} PoolShare;
+
+#ifndef NO_PTHREADS
+#define SHARE_LOCK(s)   pthread_mutex_lock(&((s)->lock))
+#define SHARE_UNLOCK(s) pthread_mutex_unlock(&((s)->lock))
+#else
+#define SHARE_LOCK(s)
+#define SHARE_UNLOCK(s)
+#endif /* !NO_PTHREADS */
+
+static int pool_steal _P((int));
+
+static PoolShare *pool_shares  = NULL; /* one share per worker      */
+static int        pool_nshares = 0;    /* shares allocated          */
+static int        pool_ndealt  = 0;    /* shares in current deal    */
+
+#ifndef NO_PTHREADS
+
+static void *pool_helper _P((void *));
+static void  pool_grow _P((int));
+
+static pthread_mutex_t pool_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done  = PTHREAD_COND_INITIALIZER;
+
+static int       pool_nhelpers = 0; /* helper threads started so far */
+static unsigned  pool_gen      = 0; /* bumped each time work is posted */
+static int       pool_nworkers;     /* workers wanted for current job */
+static int       pool_pending;      /* helpers still busy on this job */
+static void    (*pool_func) _P((int, void *));
+static void     *pool_arg;
+
+
+/* helper thread main loop; helper idx waits for a new generation of
+ * work and, if it is one of the workers wanted, runs its share
+ */
+static void *pool_helper(arg)
+     void *arg;
+{
+  int      idx;
+  unsigned gen;
+
+  idx = (int) ((long) arg);
+  gen = 0;
+
+  pthread_mutex_lock(&pool_lock);
+  while (1)
+  {
+    while (pool_gen == gen)
+      pthread_cond_wait(&pool_start, &pool_lock);
+    gen = pool_gen;
+
+    if (idx < pool_nworkers)
+    {
+      pthread_mutex_unlock(&pool_lock);
+      pool_func(idx, pool_arg);
+      pthread_mutex_lock(&pool_lock);
+
+      pool_pending -= 1;
+      if (pool_pending == 0)
+        pthread_cond_signal(&pool_done);
+    }
+  }
+
+  /* NOTREACHED */
+  return NULL;
+}
+
+
+/* make sure at least nhelpers helper threads exist; helper threads
+ * are numbered from one (the calling thread acts as worker zero)
+ */
+static void pool_grow(nhelpers)
+     int nhelpers;
+{
+  pthread_t      tid;
+  pthread_attr_t attr;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while (pool_nhelpers < nhelpers)
+  {
+    pool_nhelpers += 1;
+    if (pthread_create(&tid, &attr, pool_helper,
+                       (void *) ((long) pool_nhelpers)) != 0)
+      fatal("unable to create worker thread");
+  }
+
+  pthread_attr_destroy(&attr);
+}
+
+#endif /* !NO_PTHREADS */
+
+
+/* call func(idx, arg) for each idx in [0, nworkers), running the
+ * calls concurrently on the worker pool; returns once all of them
+ * have completed. the calling thread always handles idx zero.
+ */
+void pool_run(nworkers, func, arg)
+     int    nworkers;
+     void (*func) _P((int, void *));
+     void  *arg;
+{
+#ifndef NO_PTHREADS
+  if (nworkers > 1)
+  {
+    pthread_mutex_lock(&pool_lock);
+    pool_grow(nworkers-1);
+    pool_func     = func;
+    pool_arg      = arg;
+    pool_nworkers = nworkers;
+    pool_pending  = nworkers-1;
+    pool_gen     += 1;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+
+    func(0, arg);
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_pending > 0)
+      pthread_cond_wait(&pool_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+  }
+  else
+#endif /* !NO_PTHREADS */
+  {
+    int i;
+
+    for (i=0; i<nworkers; i++)
+      func(i, arg);
+  }
+}
+
+
+/* split items [0, nitems) into contiguous shares, one for each of
+ * the nworkers workers of the next pool_run() job, to be taken with
+ * pool_next(); must not be called while a job is running
+ */
+void pool_deal(nworkers, nitems)
+     int nworkers;
+     int nitems;
+{
+  int i;
+
+  if (pool_nshares < nworkers)
+  {
+#ifndef NO_PTHREADS
+    for (i=0; i<pool_nshares; i++)
+      pthread_mutex_destroy(&(pool_shares[i].lock));
+#endif /* !NO_PTHREADS */
+    pool_shares = (PoolShare *) realloc(pool_shares,
+                                        sizeof(PoolShare) * nworkers);
+    assert(pool_shares != NULL);
+    pool_nshares = nworkers;
+#ifndef NO_PTHREADS
+    for (i=0; i<pool_nshares; i++)
+      pthread_mutex_init(&(pool_shares[i].lock), NULL);
+#endif /* !NO_PTHREADS */
+  }
+
+  for (i=0; i<nworkers; i++)
+  {
+    pool_shares[i].next = (int) (((long) nitems * i) / nworkers);
+    pool_shares[i].end  = (int) (((long) nitems * (i+1)) / nworkers);
+  }
+  pool_ndealt = nworkers;
+}
+
+
+/* return the next item for worker idx to work on, or -1 if there are
+ * none left (in any share)
+ */
+int pool_next(idx)
+     int idx;
+{
+  int        rslt;
+  PoolShare *s;
+
+  s = &(pool_shares[idx]);
+  SHARE_LOCK(s);
+  rslt = (s->next < s->end) ? s->next++ : -1;
+  SHARE_UNLOCK(s);
+
+  return (rslt >= 0) ? rslt : pool_steal(idx);
+}
+
+
+/* worker idx has run out of items; move the back half (rounded up)
+ * of the share with the most items left into its own share and
+ * return the first of them, or return -1 if all shares are empty.
+ * no more than one share is ever locked at a time; a worker that
+ * finds every share empty while another is in the middle of a steal
+ * just stops early, leaving the stolen items to the thief.
+ */
+static int pool_steal(idx)
+     int idx;
+{
+  int        i;
+  int        left, most;
+  int        lo, hi;
+  PoolShare *s;
+  PoolShare *victim;
+
+  while (1)
+  {
+    victim = NULL;
+    most   = 0;
+    for (i=0; i<pool_ndealt; i++)
+    {
+      if (i == idx) continue;
+      s = &(pool_shares[i]);
+      SHARE_LOCK(s);
+      left = s->end - s->next;
+      SHARE_UNLOCK(s);
+      if (left > most)
+      {
+        victim = s;
+        most   = left;
+      }
+    }
+    if (victim == NULL)
+      return -1;
+
+    /* the victim may have moved on since it was looked at
+     */
+    SHARE_LOCK(victim);
+    left = victim->end - victim->next;
+    if (left <= 0)
+    {
+      SHARE_UNLOCK(victim);
+      continue;
+    }
+    hi  = victim->end;
+    lo  = hi - (left+1)/2;
+    victim->end = lo;
+    SHARE_UNLOCK(victim);
+
+    s = &(pool_shares[idx]);
+    SHARE_LOCK(s);
+    s->next = lo+1;
+    s->end  = hi;
+    SHARE_UNLOCK(s);
+
+    return lo;
+  }
+}
@@ -0,0 +1,214 @@
+/*
+ * ppmcmp.c
+ * compare two PPM images pixel by pixel
+ *
+ * Copyright (C) 1989, 1990, 1993-1995, 1999 Kirk Lauritz Johnson
+ *
+ * Parts of the source code (as marked) are:
+ *   Copyright (C) 1989, 1990, 1991 by Jim Frost
+ *   Copyright (C) 1992 by Jamie Zawinski <jwz@lucid.com>
+ *
+ * Permission to use, copy, modify and freely distribute xearth for
+ * non-commercial and not-for-profit purposes is hereby granted
+ * without fee, provided that both the above copyright notice and this
+ * permission notice appear in all copies and in supporting
+ * documentation.
+ *
+ * Unisys Corporation holds worldwide patent rights on the Lempel Zev
+ * Welch (LZW) compression technique employed in the CompuServe GIF
+ * image file format as well as in other formats. Unisys has made it
+ * clear, however, that it does not require licensing or fees to be
+ * paid for freely distributed, non-commercial applications (such as
+ * xearth) that employ LZW/GIF technology. Those wishing further
+ * information about licensing the LZW patent should contact Unisys
+ * directly at (lzw_info@unisys.com) or by writing to
+ *
+ *   Unisys Corporation
+ *   Welch Licensing Department
+ *   M/S-C1SW19
+ *   P.O. Box 500
+ *   Blue Bell, PA 19424
+ *
+ * The author makes no representations about the suitability of this
+ * software for any purpose. It is provided "as is" without express or
+ * implied warranty.
+ *
+ * THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS,
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT
+ * OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * usage: ppmcmp [-max n] a.ppm b.ppm
+ *
+ * reads two binary (P6) PPM images, such as those written by
+ * xearth's -ppm option, and reports how many pixels differ, in how
+ * many rows, and the largest difference in any one channel. exits
+ * with status 0 if no more than n pixels (default 0) differ, or 1
+ * if more do (or the images are not the same size). used by
+ * regress.sh.
+ */
+
+#include "xearth.h"
+#include "kljcpyrt.h"
+
+static u_char *read_ppm _P((const char *, int *, int *));
+static int     read_int _P((FILE *, const char *));
+
+
+int main(argc, argv)
+     int   argc;
+     char *argv[];
+{
+  int     i, j;
+  int     max;
+  int     wdth, hght;
+  int     w, h;
+  int     npix, nrows;
+  int     row_diff;
+  int     delta, max_delta;
+  u_char *a;
+  u_char *b;
+  u_char *pa;
+  u_char *pb;
+
+  max = 0;
+  i   = 1;
+  if ((argc > 2) && (strcmp(argv[1], "-max") == 0))
+  {
+    max = atoi(argv[2]);
+    i   = 3;
+  }
+  if (argc - i != 2)
+  {
+    fprintf(stderr, "usage: %s [-max n] a.ppm b.ppm\n", argv[0]);
+    exit(1);
+  }
+
+  a = read_ppm(argv[i], &wdth, &hght);
+  b = read_ppm(argv[i+1], &w, &h);
+  if ((w != wdth) || (h != hght))
+  {
+    printf("size differs (%dx%d vs %dx%d)\n", wdth, hght, w, h);
+    exit(1);
+  }
+
+  npix      = 0;
+  nrows     = 0;
+  max_delta = 0;
+  pa        = a;
+  pb        = b;
+  for (i=0; i<hght; i++)
+  {
+    row_diff = 0;
+    for (j=0; j<wdth; j++)
+    {
+      if ((pa[0] != pb[0]) || (pa[1] != pb[1]) || (pa[2] != pb[2]))
+      {
+        npix    += 1;
+        row_diff = 1;
+
+        delta = abs(pa[0] - pb[0]);
+        if (delta > max_delta) max_delta = delta;
+        delta = abs(pa[1] - pb[1]);
+        if (delta > max_delta) max_delta = delta;
+        delta = abs(pa[2] - pb[2]);
+        if (delta > max_delta) max_delta = delta;
+      }
+      pa += 3;
+      pb += 3;
+    }
+    nrows += row_diff;
+  }
+
+  printf("%d of %d pixels differ, in %d of %d rows (max delta %d)\n",
+         npix, wdth*hght, nrows, hght, max_delta);
+
+  return (npix > max) ? 1 : 0;
+}
+
+
+/* read a binary (P6) PPM image with a maxval of 255
+ */
+static u_char *read_ppm(name, wdth, hght)
+     const char *name;
+     int        *wdth;
+     int        *hght;
+{
+  int     n;
+  u_char *rslt;
+  FILE   *ins;
+
+  ins = fopen(name, "rb");
+  if (ins == NULL)
+  {
+    fprintf(stderr, "ppmcmp: unable to open %s\n", name);
+    exit(1);
+  }
+
+  if ((getc(ins) != 'P') || (getc(ins) != '6'))
+  {
+    fprintf(stderr, "ppmcmp: %s is not a binary PPM file\n", name);
+    exit(1);
+  }
+  *wdth = read_int(ins, name);
+  *hght = read_int(ins, name);
+  if (read_int(ins, name) != 255)
+  {
+    fprintf(stderr, "ppmcmp: %s has a maxval other than 255\n", name);
+    exit(1);
+  }
+
+  n    = (*wdth) * (*hght) * 3;
+  rslt = (u_char *) malloc((unsigned) n);
+  assert(rslt != NULL);
+  if (fread(rslt, 1, (unsigned) n, ins) != n)
+  {
+    fprintf(stderr, "ppmcmp: %s is truncated\n", name);
+    exit(1);
+  }
+  fclose(ins);
+
+  return rslt;
+}
+
+
+/* read a number from a PPM header, skipping whitespace and comments
+ * before it and the single whitespace character after it
+ */
+static int read_int(ins, name)
+     FILE       *ins;
+     const char *name;
+{
+  int c;
+  int rslt;
+
+  c = getc(ins);
+  while ((c == '#') || (c == ' ') || (c == '\t') || (c == '\n') ||
+         (c == '\r'))
+  {
+    if (c == '#')
+      while ((c != '\n') && (c != EOF))
+        c = getc(ins);
+    c = getc(ins);
+  }
+
+  if ((c < '0') || (c > '9'))
+  {
+    fprintf(stderr, "ppmcmp: bad header in %s\n", name);
+    exit(1);
+  }
+
+  rslt = 0;
+  while ((c >= '0') && (c <= '9'))
+  {
+    rslt = (rslt * 10) + (c - '0');
+    c = getc(ins);
+  }
+
+  return rslt;
+}
@@ -0,0 +1,189 @@
+#!/bin/sh
+#
+# regress.sh
+# compare xearth's output for a fixed set of views against a
+# reference build
+#
+# usage: sh regress.sh xearth ref-xearth
+#
+# renders each of the views listed below (as PPM images) with both
+# binaries and compares the results with ppmcmp (which, along with
+# img2tex, must already be built; "make regress REF=ref-xearth" takes
+# care of that). the
+# reference is normally an xearth built from an earlier version of
+# the source. a view fails if more pixels differ than the limit
+# given for it: simplified coastlines (used for small views) are
+# allowed to move a few pixels around, but nothing else is.
+#
+# the views all use fixed positions and sun positions (and no
+# stars), so the output does not depend on the time of day. the
+# textured ones use either gamma-test.gif or a detailed map image
+# (with sharp grid lines, which show up any drift in where texels
+# are sampled) rendered by the reference xearth.
+#
+# then xearth's SIMD shading kernels are checked against its scalar
+# ones (-simd none), which they have to match exactly; orthographic
+# shading levels cached from one frame to the next only come into
+# play with -bench, so those are compared by -bench's checksum of
+# the last frame (the second frame fills the cache, the third uses
+# it). -simd falls back on the best kernels the CPU can run, so
+# without AVX2, the avx2 checks just run the SSE2 kernels again.
+#
+# last of all, xearth renders from a tiled texture file while it gets
+# rewritten in place over and over (truncated, then written again, as
+# cp does), which it has to get through without crashing.
+#
+
+if [ $# -ne 2 ]; then
+  echo "usage: $0 xearth ref-xearth" 1>&2
+  exit 1
+fi
+
+new=$1
+ref=$2
+tmp=${TMPDIR:-/tmp}/regress.$$
+dir=`dirname $0`
+gif=$dir/gamma-test.gif
+fail=0
+
+trap 'rm -f $tmp.new $tmp.ref $tmp.png $tmp.tex $tmp.tex1 $tmp.tex2' 0
+
+$ref -png -nostars -sunpos 20,-30 -proj cyl -pos fixed,0,0 -size 720,360 \
+  -grid >$tmp.png </dev/null || exit 1
+
+# each line is the pixel limit followed by the view's options; any
+# options after a '|' are only given to the xearth being tested (for
+# those that the reference might not know about, like -threads)
+while read max opts; do
+  case "$max" in
+    ''|'#'*) continue ;;
+  esac
+  view=$opts
+  opts=`echo "$opts" | sed "s|@GIF@|$gif|g; s|@MAP@|$tmp.png|g"`
+  both=`echo "$opts" | sed 's/ *|.*//'`
+  only=`echo "$opts" | sed -n 's/.*| *//p'`
+
+  $new -ppm -nostars -sunpos 20,-30 $both $only >$tmp.new </dev/null
+  status=$?
+  if [ $status -ne 0 ]; then
+    echo "FAIL $view: exited with status $status"
+    fail=1
+    continue
+  fi
+  $ref -ppm -nostars -sunpos 20,-30 $both >$tmp.ref </dev/null
+  status=$?
+  if [ $status -ne 0 ]; then
+    echo "FAIL $view: reference exited with status $status"
+    fail=1
+    continue
+  fi
+
+  if rslt=`$dir/ppmcmp -max $max $tmp.ref $tmp.new`; then
+    echo "ok   $view: $rslt"
+  else
+    echo "FAIL $view: $rslt"
+    fail=1
+  fi
+done <<EOF
+# orthographic
+500   -proj orth -pos fixed,20,-40 -size 400,400
+500   -proj orth -pos fixed,-35,150 -rot 30 -size 400,400 -grid
+200   -proj orth -pos fixed,50,10 -size 120,120
+0     -proj orth -pos fixed,40,-75 -mag 6 -size 400,300
+0     -proj orth -pos fixed,55,-5 -mag 20 -size 500,400 -shift 120,-80
+500   -proj orth -pos fixed,20,-40 -size 400,400 | -threads 4
+250   -proj orth -pos fixed,32.49,-52.34 -rot 131 -size 262,262
+500   -proj orth -pos fixed,37.97,-108.66 -rot 35 -size 400,400
+100   -proj orth -pos fixed,-25.36,-139.14 -rot 262 -size 60,60
+
+# mercator and cylindrical
+1000  -proj merc -pos fixed,0,100 -size 900,500
+600   -proj merc -pos fixed,30,-60 -rot 20 -size 600,300
+600   -proj cyl -pos fixed,-10,20 -size 640,320 -grid
+200   -proj cyl -pos fixed,-43.21,114.84 -rot 135 -mag 1 -size 577,113 -shift -19,82
+0     -proj merc -pos fixed,45,10 -mag 8 -size 500,300
+0     -proj cyl -pos fixed,35,20 -rot 30 -mag 30 -size 500,300 -shift 90,-40
+1000  -proj merc -pos fixed,0,100 -size 900,500 | -threads 3
+
+# textured (overlays are drawn over the coastlines, so the views with
+# just overlays are zoomed in far enough for those to be at full
+# detail; gamma-test.gif's flat grays show up the odd pixel that
+# mercator shading puts a shade off, so that view is unshaded)
+0     -proj merc -pos fixed,0,100 -size 900,500 -mapfile @MAP@
+0     -proj orth -pos fixed,20,-40 -size 400,400 -mapfile @MAP@
+0     -proj cyl -pos fixed,10,60 -mag 8 -size 640,320 -overlayfile @MAP@
+0     -proj cyl -pos fixed,10,60 -size 640,320 -mapfile @MAP@ -overlayfile @GIF@
+0     -proj merc -pos fixed,0,100 -size 900,500 -noshade -mapfile @GIF@
+0     -proj orth -pos fixed,-20,120 -mag 6 -size 300,300 -overlayfile @GIF@
+0     -proj orth -pos fixed,40,-75 -mag 6 -size 400,300 -overlayfile @MAP@ -overlayfile @GIF@
+0     -proj merc -pos fixed,0,100 -size 900,500 -mapfile @MAP@ | -threads 4
+
+# views this small sample half-size copies of the map image, so they
+# are expected to differ from a reference that doesn't
+5000  -proj orth -pos fixed,0,0 -size 100,100 -mapfile @MAP@
+EOF
+
+while read opts; do
+  case "$opts" in
+    ''|'#'*) continue ;;
+  esac
+  view=$opts
+  opts=`echo "$opts" | sed "s|@GIF@|$gif|g; s|@MAP@|$tmp.png|g"`
+
+  $new -ppm -nostars -sunpos 20,-30 $opts -simd none >$tmp.ref </dev/null
+  for isa in sse2 avx2; do
+    $new -ppm -nostars -sunpos 20,-30 $opts -simd $isa >$tmp.new </dev/null
+    if rslt=`$dir/ppmcmp -max 0 $tmp.ref $tmp.new`; then
+      echo "ok   $view -simd $isa: $rslt"
+    else
+      echo "FAIL $view -simd $isa: $rslt"
+      fail=1
+    fi
+  done
+
+  for frames in 2 3; do
+    ref_sum=`$new -bench $frames -nostars -sunpos 20,-30 $opts -simd none \
+               2>&1 </dev/null | sed -n 's/.*checksum of last frame: //p'`
+    for isa in sse2 avx2; do
+      sum=`$new -bench $frames -nostars -sunpos 20,-30 $opts -simd $isa \
+             2>&1 </dev/null | sed -n 's/.*checksum of last frame: //p'`
+      if [ -n "$sum" ] && [ "$sum" = "$ref_sum" ]; then
+        echo "ok   $view -simd $isa -bench $frames: $sum"
+      else
+        echo "FAIL $view -simd $isa -bench $frames: $sum, not $ref_sum"
+        fail=1
+      fi
+    done
+  done
+done <<EOF
+-proj orth -pos fixed,20,-40 -size 401,400
+-proj orth -pos fixed,-35,150 -rot 30 -size 203,197 -grid -mapfile @MAP@
+-proj merc -pos fixed,0,100 -size 901,500 -mapfile @GIF@
+-proj cyl -pos fixed,-10,20 -size 643,320 -grid -night 30
+-proj orth -pos fixed,0,0 -size 13,9 -threads 2
+EOF
+
+view="-proj orth -pos orbit,1,0 -size 300,300 -mapfile (rewritten in place)"
+if $dir/img2tex $tmp.png >$tmp.tex1 && $dir/img2tex $gif >$tmp.tex2; then
+  cp $tmp.tex1 $tmp.tex
+  $new -bench 200 -threads 2 -proj orth -pos orbit,1,0 -size 300,300 \
+    -mapfile $tmp.tex 2>/dev/null </dev/null &
+  pid=$!
+  while kill -0 $pid 2>/dev/null; do
+    cp $tmp.tex2 $tmp.tex
+    cp $tmp.tex1 $tmp.tex
+  done
+  wait $pid
+  status=$?
+  if [ $status -ne 0 ]; then
+    echo "FAIL $view: exited with status $status"
+    fail=1
+  else
+    echo "ok   $view"
+  fi
+else
+  echo "FAIL $view: img2tex failed"
+  fail=1
+fi
+
+exit $fail
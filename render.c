@@ -46,34 +46,237 @@
 #include "xearth.h"
 #include "kljcpyrt.h"
 
+/* SIMD versions of the shading kernels: the SSE2 ones are compiled
+ * in whenever the compiler targets SSE2, the AVX2 ones whenever it
+ * can compile single functions for AVX2 (gcc 4.9 or later, or clang)
+ * and are then only used if the CPU turns out to have it (see
+ * simd_level()). define NO_SIMD to leave both out.
+ */
+#if !defined(NO_SIMD) && defined(__SSE2__)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__clang__) || \
+    (defined(__GNUC__) && ((__GNUC__ > 4) || \
+                           ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))))
+#define SIMD_AVX2
+#include <immintrin.h>
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+#endif /* !NO_SIMD && __SSE2__ */
+
 #define LABEL_LEFT_FLUSH (1<<0)
 #define LABEL_TOP_FLUSH  (1<<1)
 
+/* render() hands out rows to its workers RENDER_BAND at a time (see
+ * pool_deal()), and renders (up to) RENDER_BATCH bands per worker
+ * between passing rows on to rowfunc
+ */
+#define RENDER_BAND      (16)
+#define RENDER_BATCH     (4)
+
+/* x/255 (rounded down) without a divide; exact for 0 <= x <= 255*255
+ */
+#define Div255(x) (((x) + 1 + ((x) >> 8)) >> 8)
+
+/* does pixel p keep its color as is when shading (i.e., is it space,
+ * a star or a grid dot)? this goes by the top byte alone, which
+ * tells all of the PixType values apart from each other and from
+ * the plain RGB pixels taken from -mapfile and -overlayfile images
+ */
+#define PixFlat(p) (pix_flat[((unsigned) (p)) >> 24])
+
+/* the orthographic shading levels from one render() get reused by
+ * the next if the sun vector hasn't moved by more than this much
+ * (in any coordinate) and nothing else they depend on has changed
+ */
+#define SHADE_TOLERANCE  (1e-9)
+
+/* everything orthographic shading levels depend on
+ */
+typedef struct
+{
+  double sol[3];                /* sun vector                  */
+  double proj_scale;            /* projection (see proj_info)  */
+  double proj_xofs;
+  double proj_yofs;
+  int    wdth, hght;            /* image size                  */
+  int    night_val;             /* shading parameters          */
+  int    day_val_base;
+  double day_val_delta;
+} ShadeKey;
+
+/* everything the texture coordinate cache depends on
+ */
+typedef struct
+{
+  int    proj_type;             /* projection (see proj_info)  */
+  double proj_scale;
+  double proj_xofs;
+  double proj_yofs;
+  double cos_lat, sin_lat;      /* view (see view_pos_info)    */
+  double cos_lon, sin_lon;
+  double cos_rot, sin_rot;
+  int    wdth, hght;            /* image size                  */
+  int    ngroups;               /* texture sizes (see          */
+  int    sizes[2*(MAX_OVERLAY+1)];     /* tex_groups())        */
+} CoordKey;
+
+/* what render() workers need to render a batch of rows; inverse,
+ * source and shade are the row kernels for this frame (see
+ * pick_kernels())
+ */
+typedef struct render_job
+{
+  int        lo_y, hi_y;        /* rows in current batch       */
+  u_char    *rows;              /* rendered rows (wdth*3 each) */
+  s8or32   **scanbufs;          /* scan buffer for each worker */
+  double    *sol;               /* sun vector (if do_shade)    */
+  double    *inv_x;             /* see orth_compute_inv_x()    */
+  double    *lon_sol;           /* see compute_lon_sol()       */
+  u_char    *levels;            /* see orth_shade_setup()      */
+  int        levels_ok;         /* levels[] already filled in? */
+  double    *tex_cols;          /* see tex_cols_setup()        */
+  TexCoord  *coords;            /* see coords_setup()          */
+  int        coords_ok;         /* coords[] already filled in? */
+  TexCoord **coordbufs;         /* coords row for each worker  */
+  void     (*inverse) _P((struct render_job *, int, TexCoord *));
+  void     (*source) _P((s8or32 *, int, TexCoord *));
+  void     (*shade) _P((struct render_job *, int, int, int, s8or32 *,
+                        u_char *));
+} RenderJob;
+
+/* a set of shading kernels, one for each way pick_kernels() can
+ * shade a row
+ */
+typedef struct
+{
+  void (*orth) _P((RenderJob *, int, int, int, s8or32 *, u_char *));
+  void (*level) _P((RenderJob *, int, int, int, s8or32 *, u_char *));
+  void (*new_level) _P((RenderJob *, int, int, int, s8or32 *, u_char *));
+  void (*merc) _P((RenderJob *, int, int, int, s8or32 *, u_char *));
+  void (*cyl) _P((RenderJob *, int, int, int, s8or32 *, u_char *));
+} ShadeKernels;
+
+#ifdef SIMD_SSE2
+/* what the SIMD shading kernels need to know about a row (see
+ * simd_consts())
+ */
+typedef struct
+{
+  double a;                     /* 1-y*y (orth) or t (merc, cyl) */
+  double y_sol_1;               /* y * sol[1]                  */
+  double sol_0, sol_2;          /* rest of the sun vector      */
+  double night_v;               /* night_val, day_val_base and */
+  double day_base;              /* day_val_delta, as doubles   */
+  double day_delta;
+} ShadeConsts;
+#endif /* SIMD_SSE2 */
+
 static void new_stars _P((double));
 static void new_grid _P((int, int));
 static void new_grid_dot _P((double *, double *));
 static void new_label _P((void));
 static int dot_comp _P((const void *, const void *));
 static void render_rows_setup _P((void));
-static void render_next_row _P((s8or32 *, int));
-static void no_shade_row _P((s8or32 *, u_char *));
+static void scan_row _P((s8or32 *, int, TexCoord *));
+static void render_dots _P((s8or32 *, int));
+static void space_row _P((s8or32 *, int, u_char *));
+static void pick_kernels _P((RenderJob *));
+static void render_rows _P((int, void *));
+static void no_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                             u_char *));
 static void compute_sun_vector _P((double *));
 static void orth_compute_inv_x _P((double *));
-static void orth_shade_row _P((int, s8or32 *, double *, double *, u_char *));
-static void merc_shade_row _P((int, s8or32 *, double *, u_char *));
-static void cyl_shade_row _P((int, s8or32 *, double *, u_char *));
+static void compute_lon_sol _P((double *, double *));
+static void orth_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                               u_char *));
+static u_char *orth_shade_setup _P((double *, int *));
+static void orth_compute_levels _P((int, int, int, double *, double *,
+                                    u_char *));
+static void level_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                u_char *));
+static void new_level_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                    u_char *));
+static void merc_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                               u_char *));
+static void cyl_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                              u_char *));
+static int simd_level _P((void));
+#ifdef SIMD_SSE2
+static int simd_split _P((int, int, int, int));
+static void simd_consts _P((RenderJob *, double, double, ShadeConsts *));
+static void sse2_orth_levels _P((double *, int, ShadeConsts *, u_char *));
+static void sse2_lon_levels _P((double *, int, ShadeConsts *, u_char *));
+static void sse2_apply_levels _P((s8or32 *, u_char *, int, u_char *));
+static void sse2_orth_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                    u_char *));
+static void sse2_level_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                     u_char *));
+static void sse2_new_level_shade_row _P((RenderJob *, int, int, int,
+                                         s8or32 *, u_char *));
+static void sse2_merc_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                    u_char *));
+static void sse2_cyl_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                   u_char *));
+#endif /* SIMD_SSE2 */
+#ifdef SIMD_AVX2
+static void avx2_orth_levels _P((double *, int, ShadeConsts *, u_char *))
+  AVX2_FUNC;
+static void avx2_lon_levels _P((double *, int, ShadeConsts *, u_char *))
+  AVX2_FUNC;
+static void avx2_apply_levels _P((s8or32 *, u_char *, int, u_char *))
+  AVX2_FUNC;
+static void avx2_orth_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                    u_char *));
+static void avx2_level_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                     u_char *));
+static void avx2_new_level_shade_row _P((RenderJob *, int, int, int,
+                                         s8or32 *, u_char *));
+static void avx2_merc_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                    u_char *));
+static void avx2_cyl_shade_row _P((RenderJob *, int, int, int, s8or32 *,
+                                   u_char *));
+#endif /* SIMD_AVX2 */
+static TexCoord *coords_setup _P((int *));
+static void tex_cols_setup _P((double *));
+static void orth_coords_row _P((RenderJob *, int, TexCoord *));
+static void merc_coords_row _P((RenderJob *, int, TexCoord *));
+static void cyl_coords_row _P((RenderJob *, int, TexCoord *));
+static void map_row _P((s8or32 *, int, TexCoord *));
+static void overlay_row _P((s8or32 *, int, TexCoord *));
+static void map_overlay_row _P((s8or32 *, int, TexCoord *));
 
-static int      scanbitcnt;
 static ScanBit *scanbit;
 static s8or32   scan_to_pix[256];
+static u_char   pix_flat[256];
 
 static int    night_val;
 static int    day_val_base;
 static double day_val_delta;
 
 static ExtArr   dots = NULL;
-static int      dotcnt;
 static ScanDot *dot;
+static int     *dot_row = NULL; /* first dot for each row */
+static int      ndot_row = 0;   /* rows in dot_row        */
+
+static ExtArr   grid_dots = NULL;
+
+static int      space_rows;     /* rows w/o scanbits all space?    */
+static int      globe_lo_x;     /* columns with scanbits in them   */
+static int      globe_hi_x;     /* (globe_lo_x <= x < globe_hi_x)  */
+
+static int      nrenders = 0;   /* render() calls so far           */
+static u_char  *shade_levels = NULL; /* orthographic shading levels */
+static int      nshade_levels = 0; /* size of shade_levels         */
+static int      shade_ok = 0;   /* shade_levels filled in?         */
+static ShadeKey shade_key;      /* what they were filled in for    */
+
+static int       ntexgroups;    /* texture sizes (see tex_groups()) */
+static TexCoord *coords = NULL; /* texture coordinate cache        */
+static unsigned  ncoords = 0;   /* size of coords                  */
+static int       coords_ok = 0; /* coords filled in?               */
+static int       coords_keyed = 0; /* coords_key set?              */
+static CoordKey  coords_key;    /* view of the last render()       */
 
 
 static int dot_comp(a, b)
@@ -86,13 +289,30 @@ static int dot_comp(a, b)
 
 static void render_rows_setup()
 {
-  int i;
+  int i, j;
 
-  scanbitcnt = scanbits->count;
   scanbit    = (ScanBit *) scanbits->body;
-  dotcnt     = dots->count;
   dot        = (ScanDot *) dots->body;
 
+  /* dots are sorted by row (see do_dots()); index them the same way
+   * as scanbits (see scan_map()), so rows can be rendered in any
+   * order
+   */
+  if (ndot_row < hght+1)
+  {
+    dot_row = (int *) realloc(dot_row, sizeof(int) * (hght+1));
+    assert(dot_row != NULL);
+    ndot_row = hght+1;
+  }
+
+  j = 0;
+  for (i=0; i<=hght; i++)
+  {
+    while ((j < dots->count) && (dot[j].y < i))
+      j += 1;
+    dot_row[i] = j;
+  }
+
   /* precompute table for translating between
    * scan buffer values and pixel types
    */
@@ -103,140 +323,388 @@ static void render_rows_setup()
       scan_to_pix[i] = PixTypeLand;
     else
       scan_to_pix[i] = PixTypeWater;
-}
-
 
-static void inverse_project(y, x, lat, lon)
-    int y, x;
-    double *lat, *lon;
-{
-    double ix = INV_XPROJECT(x);
-    double iy = INV_YPROJECT(y);
-    double q[3];
-    double t;
+  /* and table for PixFlat()
+   */
+  xearth_bzero((char *) pix_flat, sizeof(pix_flat));
+  pix_flat[((unsigned) PixTypeSpace) >> 24]     = 1;
+  pix_flat[((unsigned) PixTypeStar) >> 24]      = 1;
+  pix_flat[((unsigned) PixTypeGridLand) >> 24]  = 1;
+  pix_flat[((unsigned) PixTypeGridWater) >> 24] = 1;
+
+  /* find the columns the globe (or map) covers; outside of them, and
+   * in rows without any scanbits, there is nothing but space and
+   * dots. that no longer holds with -mapfile or -overlay, which can
+   * put something on every pixel, so then just use the whole image.
+   */
+  if ((mapfile == NULL) && (overlayfile[0] == NULL))
+  {
+    space_rows = 1;
+    globe_lo_x = wdth;
+    globe_hi_x = 0;
 
-    if (proj_type == ProjTypeOrthographic)
-    {
-        q[0] = ix;
-        q[1] = iy;
-        q[2] = sqrt(1 - (ix*ix + iy*iy));
-    }
-    else if (proj_type == ProjTypeMercator)
+    j = scanbit_row[hght];
+    for (i=0; i<j; i++)
     {
-        q[1] = INV_MERCATOR_Y(iy);
-        t = sqrt(1 - q[1]*q[1]);
-        q[0] = sin(ix) * t;
-        q[2] = cos(ix) * t;
+      if (scanbit[i].lo_x < globe_lo_x)
+        globe_lo_x = scanbit[i].lo_x;
+      if (scanbit[i].hi_x >= globe_hi_x)
+        globe_hi_x = scanbit[i].hi_x + 1;
     }
-    else /* (proj_type == ProjTypeCylindrical) */
-    {
-        q[1] = INV_CYLINDRICAL_Y(iy);
-        t = sqrt(1 - q[1]*q[1]);
-        q[0] = sin(ix) * t;
-        q[2] = cos(ix) * t;
-    }
-    /* inverse of XFORM_ROTATE */
-    {
-      double _p0_, _p1_, _p2_;
-      double _c_, _s_, _t_;
-      _p0_ = q[0];
-      _p1_ = q[1];
-      _p2_ = q[2];
-      _c_  = view_pos_info.cos_rot;
-      _s_  = -view_pos_info.sin_rot;
-      _t_  = (_c_ * _p0_) - (_s_ * _p1_);
-      _p1_ = (_s_ * _p0_) + (_c_ * _p1_);
-      _p0_ = _t_;
-      _c_  = view_pos_info.cos_lat;
-      _s_  = -view_pos_info.sin_lat;
-      _t_  = (_c_ * _p1_) - (_s_ * _p2_);
-      _p2_ = (_s_ * _p1_) + (_c_ * _p2_);
-      _p1_ = _t_;
-      _c_  = view_pos_info.cos_lon;
-      _s_  = -view_pos_info.sin_lon;
-      _t_  = (_c_ * _p0_) - (_s_ * _p2_);
-      _p2_ = (_s_ * _p0_) + (_c_ * _p2_);
-      _p0_ = _t_;
-      q[0] = _p0_;
-      q[1] = _p1_;
-      q[2] = _p2_;
-    }
-    *lat = asin(q[1]);
-    *lon = atan2(q[0], q[2]);
+
+    if (globe_lo_x > globe_hi_x)
+      globe_lo_x = globe_hi_x;
+  }
+  else
+  {
+    space_rows = 0;
+    globe_lo_x = 0;
+    globe_hi_x = wdth;
+  }
 }
 
 
-static void render_next_row(buf, idx)
-     s8or32 *buf;
-     int     idx;
+/* fill in buf[] for row idx from the scanbits (used when there is
+ * no -mapfile; tc is ignored)
+ */
+static void scan_row(buf, idx, tc)
+     s8or32   *buf;
+     int       idx;
+     TexCoord *tc;
 {
   int      i, i_lim;
   int      tmp;
   int      _scanbitcnt;
   ScanBit *_scanbit;
-  double   lat, lon;
-  int      p;
 
-  xearth_bzero((char *) buf, (unsigned) (sizeof(s8or32) * wdth));
+  /* the scanbits for this row (see scan_map()); use local variables
+   * to help compilers figure out that they can be registered
+   */
+  _scanbitcnt = scanbit_row[idx+1] - scanbit_row[idx];
+  _scanbit    = scanbit + scanbit_row[idx];
+
+  /* rather than adding each scanbit's val to every pixel it covers,
+   * note where it starts and stops counting (buf[] has room for one
+   * past the last pixel) ...
+   */
+  xearth_bzero((char *) (buf + globe_lo_x),
+               (unsigned) (sizeof(s8or32) * (globe_hi_x-globe_lo_x+1)));
+  while (_scanbitcnt > 0)
+  {
+    tmp = _scanbit->val;
+    buf[_scanbit->lo_x]   += tmp;
+    buf[_scanbit->hi_x+1] -= tmp;
+
+    _scanbit    += 1;
+    _scanbitcnt -= 1;
+  }
+
+  /* ... then add those up across the row in one pass, translating
+   * the totals into pixel types as we go; outside of the globe's
+   * columns, there is only space
+   */
+  i_lim = globe_lo_x;
+  for (i=0; i<i_lim; i++)
+    buf[i] = PixTypeSpace;
 
-  if (mapfile == NULL)
+  tmp   = 0;
+  i_lim = globe_hi_x;
+  for (; i<i_lim; i++)
   {
-    /* explicitly copy scanbitcnt and scanbit to local variables
-     * to help compilers figure out that they can be registered
-     */
-    _scanbitcnt = scanbitcnt;
-    _scanbit    = scanbit;
+    tmp   += buf[i];
+    buf[i] = scan_to_pix[tmp & 0xff];
+  }
 
-    while ((_scanbitcnt > 0) && (_scanbit->y == idx))
-    {
-      /* use i_lim to encourage compilers to register loop limit
-       */
-      i_lim = _scanbit->hi_x;
-      tmp   = _scanbit->val;
-      for (i=_scanbit->lo_x; i<=i_lim; i++)
-        buf[i] += tmp;
+  i_lim = wdth;
+  for (; i<i_lim; i++)
+    buf[i] = PixTypeSpace;
+}
 
-      _scanbit    += 1;
-      _scanbitcnt -= 1;
-    }
 
-    /* copy changes to scanbitcnt and scanbit out to memory
-     */
-    scanbitcnt = _scanbitcnt;
-    scanbit    = _scanbit;
+/* decide how the texture coordinates of each pixel (for -mapfile
+ * and -overlay) get handled this time around: if the cache from last
+ * time is still good, returns it (and sets *ok). otherwise, if the
+ * view is the same as last time, returns where to cache the new
+ * ones; if it changed (say, with -pos sunrel), returns NULL, since
+ * they probably won't get used again. either way, sets ntexgroups.
+ */
+static TexCoord *coords_setup(ok)
+     int *ok;
+{
+  int      i;
+  unsigned n;
+  int      same;
+  CoordKey key;
+
+  key.proj_type  = proj_type;
+  key.proj_scale = proj_info.proj_scale;
+  key.proj_xofs  = proj_info.proj_xofs;
+  key.proj_yofs  = proj_info.proj_yofs;
+  key.cos_lat    = view_pos_info.cos_lat;
+  key.sin_lat    = view_pos_info.sin_lat;
+  key.cos_lon    = view_pos_info.cos_lon;
+  key.sin_lon    = view_pos_info.sin_lon;
+  key.cos_rot    = view_pos_info.cos_rot;
+  key.sin_rot    = view_pos_info.sin_rot;
+  key.wdth       = wdth;
+  key.hght       = hght;
+  key.ngroups    = tex_groups(key.sizes);
+  ntexgroups     = key.ngroups;
+
+  same = (coords_keyed &&
+          (key.proj_type  == coords_key.proj_type) &&
+          (key.proj_scale == coords_key.proj_scale) &&
+          (key.proj_xofs  == coords_key.proj_xofs) &&
+          (key.proj_yofs  == coords_key.proj_yofs) &&
+          (key.cos_lat    == coords_key.cos_lat) &&
+          (key.sin_lat    == coords_key.sin_lat) &&
+          (key.cos_lon    == coords_key.cos_lon) &&
+          (key.sin_lon    == coords_key.sin_lon) &&
+          (key.cos_rot    == coords_key.cos_rot) &&
+          (key.sin_rot    == coords_key.sin_rot) &&
+          (key.wdth       == coords_key.wdth) &&
+          (key.hght       == coords_key.hght) &&
+          (key.ngroups    == coords_key.ngroups));
+  for (i=0; same && (i<2*key.ngroups); i++)
+    if (key.sizes[i] != coords_key.sizes[i])
+      same = 0;
+
+  *ok = 0;
+  if (!same)
+  {
+    coords_key   = key;
+    coords_keyed = 1;
+    coords_ok    = 0;
+    return NULL;
   }
-  else
+
+  if (coords_ok)
+  {
+    *ok = 1;
+    return coords;
+  }
+
+  n = sizeof(TexCoord) * ntexgroups * wdth * hght;
+  if (ncoords < n)
   {
-    for (i=0; i<=wdth; i++)
+    coords = (TexCoord *) realloc(coords, n);
+    assert(coords != NULL);
+    ncoords = n;
+  }
+
+  /* (render() fills all of them in before it returns)
+   */
+  coords_ok = 1;
+
+  return coords;
+}
+
+
+/* the parts of the inverse projection that only depend on the
+ * column, four doubles per column: for the orthographic projection,
+ * x, x squared, and x times the cosine and sine of view_rot; for the
+ * others, sin(x) and cos(x) (and two spares)
+ */
+static void tex_cols_setup(cols)
+     double *cols;
+{
+  int    i;
+  double x;
+
+  for (i=0; i<wdth; i++)
+  {
+    x = INV_XPROJECT(i);
+
+    if (proj_type == ProjTypeOrthographic)
     {
-      inverse_project(idx, i, &lat, &lon);
-      p = map_pixel(lat, lon);
-      if (p != -1) {
-          buf[i] = 0x40000000 | p;
-      }
+      cols[0] = x;
+      cols[1] = x * x;
+      cols[2] = view_pos_info.cos_rot * x;
+      cols[3] = view_pos_info.sin_rot * x;
+    }
+    else
+    {
+      cols[0] = sin(x);
+      cols[1] = cos(x);
+      cols[2] = 0;
+      cols[3] = 0;
     }
+
+    cols += 4;
   }
+}
+
+
+/* undo the view_lat and view_lon steps of XFORM_ROTATE() on (p0, p1,
+ * p2), one at a time (the view_rot step is left to the kernels
+ * below, which mostly have it done already)
+ */
+#define INV_ROTATE_LAT_LON(p0, p1, p2)                          \
+ do {                                                           \
+  double _t_;                                                   \
+  _t_ = (view_pos_info.cos_lat * (p1))                          \
+    + (view_pos_info.sin_lat * (p2));                           \
+  (p2) = (view_pos_info.cos_lat * (p2))                         \
+    - (view_pos_info.sin_lat * (p1));                           \
+  (p1) = _t_;                                                   \
+  _t_ = (view_pos_info.cos_lon * (p0))                          \
+    + (view_pos_info.sin_lon * (p2));                           \
+  (p2) = (view_pos_info.cos_lon * (p2))                         \
+    - (view_pos_info.sin_lon * (p0));                           \
+  (p0) = _t_;                                                   \
+ } while (0)
+
+
+/* inverse projection kernels: fill in tc[] with the texture
+ * coordinates (see tex_coord()) of each pixel in row idx,
+ * ntexgroups per pixel. the rotation back from view coordinates is
+ * done one angle at a time, in the same order as always, so that
+ * the latitude and longitude of each pixel (and so which texel it
+ * lands on) come out exactly the same as they used to; everything
+ * that only depends on the column comes from job->tex_cols[] (see
+ * tex_cols_setup()), and everything that only depends on the row is
+ * done once per row.
+ */
+static void orth_coords_row(job, idx, tc)
+     RenderJob *job;
+     int        idx;
+     TexCoord  *tc;
+{
+  int     i, i_lim;
+  double  iy, iy2;
+  double  cy, sy;
+  double  p0, p1, p2;
+  double *cols;
+
+  iy  = INV_YPROJECT(idx);
+  iy2 = iy * iy;
+  cy  = view_pos_info.cos_rot * iy;
+  sy  = view_pos_info.sin_rot * iy;
+
+  cols = job->tex_cols;
 
   /* use i_lim to encourage compilers to register loop limit
    */
   i_lim = wdth;
   for (i=0; i<i_lim; i++)
   {
-    if ((buf[i] & 0x40000000) == 0)
-      buf[i] = scan_to_pix[(int) (buf[i] & 0xff)];
+    p2 = sqrt(1 - (cols[1] + iy2));
+    p0 = cols[2] + sy;
+    p1 = cy - cols[3];
+    INV_ROTATE_LAT_LON(p0, p1, p2);
 
-    if (overlayfile[0] != NULL)
-    {
-      inverse_project(idx, i, &lat, &lon);
-      buf[i] = overlay_pixel(lat, lon, buf[i]);
-    }
+    tex_coord(asin(p1), atan2(p0, p2), tc);
+
+    cols += 4;
+    tc   += ntexgroups;
   }
+}
+
+
+/* template for the mercator and cylindrical inverse projection
+ * kernels (INV_Y is INV_MERCATOR_Y() or INV_CYLINDRICAL_Y())
+ */
+#define LON_COORDS_ROW(name, INV_Y)                             \
+static void name(job, idx, tc)                                  \
+     RenderJob *job;                                            \
+     int        idx;                                            \
+     TexCoord  *tc;                                             \
+{                                                               \
+  int     i, i_lim;                                             \
+  double  y, t;                                                 \
+  double  cy, sy;                                               \
+  double  q0;                                                   \
+  double  p0, p1, p2;                                           \
+  double *cols;                                                 \
+                                                                \
+  y  = INV_YPROJECT(idx);                                       \
+  y  = INV_Y(y);                                                \
+  t  = sqrt(1 - (y*y));                                         \
+  cy = view_pos_info.cos_rot * y;                               \
+  sy = view_pos_info.sin_rot * y;                               \
+                                                                \
+  cols = job->tex_cols;                                         \
+                                                                \
+  /* use i_lim to encourage compilers to register loop limit    \
+   */                                                           \
+  i_lim = wdth;                                                 \
+  for (i=0; i<i_lim; i++)                                       \
+  {                                                             \
+    q0 = cols[0] * t;                                           \
+    p2 = cols[1] * t;                                           \
+    p0 = (view_pos_info.cos_rot * q0) + sy;                     \
+    p1 = cy - (view_pos_info.sin_rot * q0);                     \
+    INV_ROTATE_LAT_LON(p0, p1, p2);                             \
+                                                                \
+    tex_coord(asin(p1), atan2(p0, p2), tc);                     \
+                                                                \
+    cols += 4;                                                  \
+    tc   += ntexgroups;                                         \
+  }                                                             \
+}
+
+LON_COORDS_ROW(merc_coords_row, INV_MERCATOR_Y)
+LON_COORDS_ROW(cyl_coords_row, INV_CYLINDRICAL_Y)
+
+
+/* template for the kernels that fill in buf[] for row idx with
+ * -mapfile and/or -overlay, given the texture coordinates of each
+ * pixel in tc[]: one for each combination of MAP (-mapfile?) and
+ * OVERLAY (-overlay?), so that the per-pixel loop doesn't have to
+ * test for either
+ */
+#define TEXTURE_ROW(name, MAP, OVERLAY)                         \
+static void name(buf, idx, tc)                                  \
+     s8or32   *buf;                                             \
+     int       idx;                                             \
+     TexCoord *tc;                                              \
+{                                                               \
+  int i, i_lim;                                                 \
+  int p;                                                        \
+                                                                \
+  if (!(MAP))                                                   \
+    scan_row(buf, idx, NULL);                                   \
+                                                                \
+  /* use i_lim to encourage compilers to register loop limit    \
+   */                                                           \
+  i_lim = wdth;                                                 \
+  for (i=0; i<i_lim; i++)                                       \
+  {                                                             \
+    if (MAP)                                                    \
+    {                                                           \
+      p = map_pixel(tc);                                        \
+      if (p != -1)                                              \
+        buf[i] = 0x40000000 | p;                                \
+      else                                                      \
+        buf[i] = PixTypeSpace;                                  \
+    }                                                           \
+                                                                \
+    if (OVERLAY)                                                \
+      buf[i] = overlay_pixel(tc, buf[i]);                       \
+                                                                \
+    tc += ntexgroups;                                           \
+  }                                                             \
+}
+
+TEXTURE_ROW(map_row, 1, 0)
+TEXTURE_ROW(overlay_row, 0, 1)
+TEXTURE_ROW(map_overlay_row, 1, 1)
+
+
+/* draw the dots (stars, grid, label) for row idx into buf[]
+ */
+static void render_dots(buf, idx)
+     s8or32 *buf;
+     int     idx;
+{
+  int i;
+  int tmp;
 
-  while ((dotcnt > 0) && (dot->y == idx))
+  for (i=dot_row[idx]; i<dot_row[idx+1]; i++)
   {
-    tmp = dot->x;
+    tmp = dot[i].x;
 
-    if (dot->type == DotTypeStar)
+    if (dot[i].type == DotTypeStar)
     {
       if (buf[tmp] == PixTypeSpace)
         buf[tmp] = PixTypeStar;
@@ -245,23 +713,72 @@ static void render_next_row(buf, idx)
     {
       buf[tmp] = PixTypeGridLand;
     }
-
-    dot    += 1;
-    dotcnt -= 1;
   }
 }
 
 
-static void no_shade_row(scanbuf, rslt)
-     s8or32 *scanbuf;
+/* fast path for a row that lies entirely outside the globe (see
+ * render_rows_setup()): fill rslt[] with space, then put in just the
+ * pixels the row's dots land on (using buf[] to sort out stars
+ * falling on grid or label dots the same way render_dots() does)
+ */
+static void space_row(buf, idx, rslt)
+     s8or32 *buf;
+     int     idx;
      u_char *rslt;
+{
+  int    i, i_lim;
+  int    x;
+  s8or32 p;
+  u_char r, g, b;
+
+  r = PixRed(PixTypeSpace);
+  g = PixGreen(PixTypeSpace);
+  b = PixBlue(PixTypeSpace);
+
+  /* use i_lim to encourage compilers to register loop limit
+   */
+  i_lim = wdth*3;
+  for (i=0; i<i_lim; i+=3)
+  {
+    rslt[i]   = r;
+    rslt[i+1] = g;
+    rslt[i+2] = b;
+  }
+
+  i_lim = dot_row[idx+1];
+  for (i=dot_row[idx]; i<i_lim; i++)
+    buf[dot[i].x] = PixTypeSpace;
+
+  render_dots(buf, idx);
+
+  for (i=dot_row[idx]; i<i_lim; i++)
+  {
+    x = dot[i].x;
+    p = buf[x];
+    rslt[x*3]   = PixRed(p);
+    rslt[x*3+1] = PixGreen(p);
+    rslt[x*3+2] = PixBlue(p);
+  }
+}
+
+
+static void no_shade_row(job, idx, lo, hi, scanbuf, rslt)
+     RenderJob *job;
+     int        idx;
+     int        lo;
+     int        hi;
+     s8or32    *scanbuf;
+     u_char    *rslt;
 {
   int i, i_lim;
 
+  rslt += lo*3;
+
   /* use i_lim to encourage compilers to register loop limit
    */
-  i_lim = wdth;
-  for (i=0; i<i_lim; i++)
+  i_lim = hi;
+  for (i=lo; i<i_lim; i++)
   {
     rslt[0] = PixRed(scanbuf[i]);
     rslt[1] = PixGreen(scanbuf[i]);
@@ -294,68 +811,102 @@ static void orth_compute_inv_x(inv_x)
 }
 
 
-static void orth_shade_row(idx, scanbuf, sol, inv_x, rslt)
-     int     idx;
-     s8or32 *scanbuf;
+/* for the mercator and cylindrical projections, the point shown in
+ * column i of row y is (sin(lon)*t, y, cos(lon)*t), where lon is
+ * INV_XPROJECT(i) and t is sqrt(1-y*y); so its dot product with the
+ * sun vector is t*lon_sol[i] + y*sol[1], with lon_sol[i] as below
+ */
+static void compute_lon_sol(sol, lon_sol)
      double *sol;
-     double *inv_x;
-     u_char *rslt;
+     double *lon_sol;
 {
   int    i, i_lim;
-  int    scanbuf_val;
-  int    val;
-  double x, y, z;
-  double scale;
-  double tmp;
-  double y_sol_1;
+  double lon;
 
-  y = INV_YPROJECT(idx);
+  i_lim = wdth;
+  for (i=0; i<i_lim; i++)
+  {
+    lon        = INV_XPROJECT(i);
+    lon_sol[i] = (sin(lon) * sol[0]) + (cos(lon) * sol[2]);
+  }
+}
+
+
+static void orth_shade_row(job, idx, lo, hi, scanbuf, rslt)
+     RenderJob *job;
+     int        idx;
+     int        lo;
+     int        hi;
+     s8or32    *scanbuf;
+     u_char    *rslt;
+{
+  int     i, i_lim;
+  int     scanbuf_val;
+  int     val;
+  double  x, y, z;
+  double  scale;
+  double  tmp;
+  double  y_sol_1;
+  double  sol_0, sol_2;
+  double *sol;
+  double *inv_x;
+  int     night_v;
+  int     day_base;
+  double  day_delta;
 
-  /* save a little computation in the inner loop
+  sol   = job->sol;
+  inv_x = job->inv_x;
+  y     = INV_YPROJECT(idx);
+
+  /* save a little computation in the inner loop, and copy things
+   * it uses to local variables (the stores through rslt could
+   * otherwise force compilers to reload them for every pixel)
    */
-  tmp     = 1 - (y*y);
-  y_sol_1 = y * sol[1];
+  tmp       = 1 - (y*y);
+  y_sol_1   = y * sol[1];
+  sol_0     = sol[0];
+  sol_2     = sol[2];
+  night_v   = night_val;
+  day_base  = day_val_base;
+  day_delta = day_val_delta;
+
+  rslt += lo*3;
 
   /* use i_lim to encourage compilers to register loop limit
    */
-  i_lim = wdth;
-  for (i=0; i<i_lim; i++)
+  i_lim = hi;
+  for (i=lo; i<i_lim; i++)
   {
     scanbuf_val = scanbuf[i];
 
-    switch (scanbuf_val)
+    if (PixFlat(scanbuf_val))
     {
-    case PixTypeSpace:
-    case PixTypeStar:
-    case PixTypeGridLand:
-    case PixTypeGridWater:
       rslt[0] = PixRed(scanbuf_val);
       rslt[1] = PixGreen(scanbuf_val);
       rslt[2] = PixBlue(scanbuf_val);
-      break;
-
-    default:
+    }
+    else
+    {
       x = inv_x[i];
       z = tmp - (x*x);
       z = SQRT(z);
-      scale = (x * sol[0]) + y_sol_1 + (z * sol[2]);
+      scale = (x * sol_0) + y_sol_1 + (z * sol_2);
       if (scale < 0)
       {
-	val = night_val;
+	val = night_v;
       }
       else
       {
-	val = day_val_base + (scale * day_val_delta);
+	val = day_base + (scale * day_delta);
 	if (val > 255)
 	  val = 255;
 	else
 	  assert(val >= 0);
       }
 
-      rslt[0] = PixRed(scanbuf_val) * val / 255;
-      rslt[1] = PixGreen(scanbuf_val) * val / 255;
-      rslt[2] = PixBlue(scanbuf_val) * val / 255;
-      break;
+      rslt[0] = Div255(PixRed(scanbuf_val) * val);
+      rslt[1] = Div255(PixGreen(scanbuf_val) * val);
+      rslt[2] = Div255(PixBlue(scanbuf_val) * val);
     }
 
     rslt += 3;
@@ -363,221 +914,881 @@ static void orth_shade_row(idx, scanbuf, sol, inv_x, rslt)
 }
 
 
-static void merc_shade_row(idx, scanbuf, sol, rslt)
+/* decide how orthographic shading levels get handled this time
+ * around: if those from last time can be reused, returns them (and
+ * sets *ok); otherwise, returns where to keep the new ones (or NULL,
+ * on the first render(), since most runs render only once and then
+ * there is no point in keeping them).
+ */
+static u_char *orth_shade_setup(sol, ok)
+     double *sol;
+     int    *ok;
+{
+  int      i;
+  unsigned n;
+  ShadeKey key;
+
+  for (i=0; i<3; i++)
+    key.sol[i] = sol[i];
+  key.proj_scale    = proj_info.proj_scale;
+  key.proj_xofs     = proj_info.proj_xofs;
+  key.proj_yofs     = proj_info.proj_yofs;
+  key.wdth          = wdth;
+  key.hght          = hght;
+  key.night_val     = night_val;
+  key.day_val_base  = day_val_base;
+  key.day_val_delta = day_val_delta;
+
+  *ok = 0;
+  if (shade_ok &&
+      (fabs(key.sol[0] - shade_key.sol[0]) <= SHADE_TOLERANCE) &&
+      (fabs(key.sol[1] - shade_key.sol[1]) <= SHADE_TOLERANCE) &&
+      (fabs(key.sol[2] - shade_key.sol[2]) <= SHADE_TOLERANCE) &&
+      (key.proj_scale    == shade_key.proj_scale) &&
+      (key.proj_xofs     == shade_key.proj_xofs) &&
+      (key.proj_yofs     == shade_key.proj_yofs) &&
+      (key.wdth          == shade_key.wdth) &&
+      (key.hght          == shade_key.hght) &&
+      (key.night_val     == shade_key.night_val) &&
+      (key.day_val_base  == shade_key.day_val_base) &&
+      (key.day_val_delta == shade_key.day_val_delta))
+  {
+    *ok = 1;
+    return shade_levels;
+  }
+
+  shade_ok = 0;
+  if (nrenders == 1)
+    return NULL;
+
+  n = wdth * hght;
+  if (nshade_levels < n)
+  {
+    shade_levels = (u_char *) realloc(shade_levels, n);
+    assert(shade_levels != NULL);
+    nshade_levels = n;
+  }
+
+  /* (render() fills all of them in before it returns)
+   */
+  shade_key = key;
+  shade_ok  = 1;
+
+  return shade_levels;
+}
+
+
+/* like orth_shade_row(), but just compute the shading level for
+ * every pixel in columns lo through hi-1 of row idx (whatever is
+ * there) into rslt[]
+ */
+static void orth_compute_levels(idx, lo, hi, sol, inv_x, rslt)
      int     idx;
-     s8or32 *scanbuf;
+     int     lo;
+     int     hi;
      double *sol;
+     double *inv_x;
      u_char *rslt;
 {
   int    i, i_lim;
-  int    scanbuf_val;
   int    val;
   double x, y, z;
-  double sin_theta;
-  double cos_theta;
   double scale;
   double tmp;
   double y_sol_1;
+  double sol_0, sol_2;
+  int    night_v;
+  int    day_base;
+  double day_delta;
 
   y = INV_YPROJECT(idx);
-  y = INV_MERCATOR_Y(y);
-
-  /* conceptually, on each iteration of the i loop, we want:
-   *
-   *   x = sin(INV_XPROJECT(i)) * sqrt(1 - (y*y));
-   *   z = cos(INV_XPROJECT(i)) * sqrt(1 - (y*y));
-   *
-   * computing this directly is rather expensive, however, so we only
-   * compute the first (i=0) pair of values directly; all other pairs
-   * (i>0) are obtained through successive rotations of the original
-   * pair (by inv_proj_scale radians).
-   */
 
-  /* compute initial (x, z) values
+  /* save a little computation in the inner loop, and copy things
+   * it uses to local variables (see orth_shade_row())
    */
-  tmp = sqrt(1 - (y*y));
-  x   = sin(INV_XPROJECT(0)) * tmp;
-  z   = cos(INV_XPROJECT(0)) * tmp;
+  tmp       = 1 - (y*y);
+  y_sol_1   = y * sol[1];
+  sol_0     = sol[0];
+  sol_2     = sol[2];
+  night_v   = night_val;
+  day_base  = day_val_base;
+  day_delta = day_val_delta;
 
-  /* compute rotation coefficients used
-   * to find subsequent (x, z) values
+  /* use i_lim to encourage compilers to register loop limit
    */
-  tmp = proj_info.inv_proj_scale;
-  sin_theta = sin(tmp);
-  cos_theta = cos(tmp);
+  i_lim = hi;
+  for (i=lo; i<i_lim; i++)
+  {
+    x = inv_x[i];
+    z = tmp - (x*x);
+    z = SQRT(z);
+    scale = (x * sol_0) + y_sol_1 + (z * sol_2);
+    if (scale < 0)
+    {
+      val = night_v;
+    }
+    else
+    {
+      val = day_base + (scale * day_delta);
+      if (val > 255)
+        val = 255;
+      else
+        assert(val >= 0);
+    }
 
-  /* save a little computation in the inner loop
-   */
-  y_sol_1 = y * sol[1];
+    rslt[i] = val;
+  }
+}
+
+
+/* shade a row using shading levels from orth_compute_levels()
+ */
+static void level_shade_row(job, idx, lo, hi, scanbuf, rslt)
+     RenderJob *job;
+     int        idx;
+     int        lo;
+     int        hi;
+     s8or32    *scanbuf;
+     u_char    *rslt;
+{
+  int     i, i_lim;
+  int     scanbuf_val;
+  int     val;
+  u_char *levels;
+
+  levels = job->levels + (idx * wdth);
+
+  rslt += lo*3;
 
   /* use i_lim to encourage compilers to register loop limit
    */
-  i_lim = wdth;
-  for (i=0; i<i_lim; i++)
+  i_lim = hi;
+  for (i=lo; i<i_lim; i++)
   {
     scanbuf_val = scanbuf[i];
 
-    switch (scanbuf_val)
+    if (PixFlat(scanbuf_val))
     {
-    case PixTypeSpace:
-    case PixTypeStar:
-    case PixTypeGridLand:
-    case PixTypeGridWater:
       rslt[0] = PixRed(scanbuf_val);
       rslt[1] = PixGreen(scanbuf_val);
       rslt[2] = PixBlue(scanbuf_val);
-      break;
+    }
+    else
+    {
+      val = levels[i];
+      rslt[0] = Div255(PixRed(scanbuf_val) * val);
+      rslt[1] = Div255(PixGreen(scanbuf_val) * val);
+      rslt[2] = Div255(PixBlue(scanbuf_val) * val);
+    }
 
-    default:
-      scale = (x * sol[0]) + y_sol_1 + (z * sol[2]);
-      if (scale < 0)
-      {
-	val = night_val;
-      }
-      else
-      {
-	val = day_val_base + (scale * day_val_delta);
-	if (val > 255)
-	  val = 255;
-	else
-	  assert(val >= 0);
-      }
+    rslt += 3;
+  }
+}
 
-      rslt[0] = PixRed(scanbuf_val) * val / 255;
-      rslt[1] = PixGreen(scanbuf_val) * val / 255;
-      rslt[2] = PixBlue(scanbuf_val) * val / 255;
-      break;
-    }
 
-    /* compute next (x, z) values via 2-d rotation
+/* like level_shade_row(), but fill in the row's shading levels
+ * first (see orth_shade_setup())
+ */
+static void new_level_shade_row(job, idx, lo, hi, scanbuf, rslt)
+     RenderJob *job;
+     int        idx;
+     int        lo;
+     int        hi;
+     s8or32    *scanbuf;
+     u_char    *rslt;
+{
+  orth_compute_levels(idx, 0, wdth, job->sol, job->inv_x,
+                      job->levels + (idx * wdth));
+  level_shade_row(job, idx, lo, hi, scanbuf, rslt);
+}
+
+
+/* template for the mercator and cylindrical shading kernels, which
+ * only differ in how they take a row back to a latitude (INV_Y is
+ * INV_MERCATOR_Y() or INV_CYLINDRICAL_Y())
+ */
+#define LON_SHADE_ROW(name, INV_Y)                              \
+static void name(job, idx, lo, hi, scanbuf, rslt)               \
+     RenderJob *job;                                            \
+     int        idx;                                            \
+     int        lo;                                             \
+     int        hi;                                             \
+     s8or32    *scanbuf;                                        \
+     u_char    *rslt;                                           \
+{                                                               \
+  int     i, i_lim;                                             \
+  int     scanbuf_val;                                          \
+  int     val;                                                  \
+  double  y, t;                                                 \
+  double  scale;                                                \
+  double  y_sol_1;                                              \
+  double *lon_sol;                                              \
+  int     night_v;                                              \
+  int     day_base;                                             \
+  double  day_delta;                                            \
+                                                                \
+  y = INV_YPROJECT(idx);                                        \
+  y = INV_Y(y);                                                 \
+  t = sqrt(1 - (y*y));                                          \
+                                                                \
+  /* save a little computation in the inner loop, and copy      \
+   * things it uses to local variables (see orth_shade_row())   \
+   */                                                           \
+  y_sol_1   = y * job->sol[1];                                  \
+  lon_sol   = job->lon_sol;                                     \
+  night_v   = night_val;                                        \
+  day_base  = day_val_base;                                     \
+  day_delta = day_val_delta;                                    \
+                                                                \
+  rslt += lo*3;                                                 \
+                                                                \
+  /* use i_lim to encourage compilers to register loop limit    \
+   */                                                           \
+  i_lim = hi;                                                   \
+  for (i=lo; i<i_lim; i++)                                      \
+  {                                                             \
+    scanbuf_val = scanbuf[i];                                   \
+                                                                \
+    if (PixFlat(scanbuf_val))                                   \
+    {                                                           \
+      rslt[0] = PixRed(scanbuf_val);                            \
+      rslt[1] = PixGreen(scanbuf_val);                          \
+      rslt[2] = PixBlue(scanbuf_val);                           \
+    }                                                           \
+    else                                                        \
+    {                                                           \
+      scale = (t * lon_sol[i]) + y_sol_1;                       \
+      if (scale < 0)                                            \
+      {                                                         \
+        val = night_v;                                          \
+      }                                                         \
+      else                                                      \
+      {                                                         \
+        val = day_base + (scale * day_delta);                   \
+        if (val > 255)                                          \
+          val = 255;                                            \
+        else                                                    \
+          assert(val >= 0);                                     \
+      }                                                         \
+                                                                \
+      rslt[0] = Div255(PixRed(scanbuf_val) * val);              \
+      rslt[1] = Div255(PixGreen(scanbuf_val) * val);            \
+      rslt[2] = Div255(PixBlue(scanbuf_val) * val);             \
+    }                                                           \
+                                                                \
+    rslt += 3;                                                  \
+  }                                                             \
+}
+
+LON_SHADE_ROW(merc_shade_row, INV_MERCATOR_Y)
+LON_SHADE_ROW(cyl_shade_row, INV_CYLINDRICAL_Y)
+
+
+/* which shading kernels pick_kernels() should use: the best ones the
+ * CPU can run, but nothing past -simd
+ */
+static int simd_level()
+{
+  int level;
+
+  level = SimdNone;
+#ifdef SIMD_SSE2
+  level = SimdSSE2;
+#ifdef SIMD_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    level = SimdAVX2;
+#endif /* SIMD_AVX2 */
+#endif /* SIMD_SSE2 */
+
+  if (level > use_simd)
+    level = use_simd;
+
+  return level;
+}
+
+
+#ifdef SIMD_SSE2
+
+/* the SIMD shading kernels go through a row in two passes: one to
+ * work out the shading levels (in double lanes, one operation for
+ * every one orth_shade_row() and friends do, so they come out the
+ * same), and one to apply them (in 16-bit lanes, with flat pixels
+ * picked out by comparing their top bytes and given level 255, which
+ * leaves them as they are). they take SIMD_CHUNK pixels at a time,
+ * and leave whatever doesn't make up a whole number of steps at the
+ * end of the row to the scalar kernels.
+ */
+#define SIMD_CHUNK (256)
+
+/* is each 32-bit lane of p (a scan buffer value) flat? (see PixFlat())
+ */
+#define PixTop(t) ((int) (((unsigned) (t)) >> 24))
+#define SSE2_FLAT(p)                                                    \
+  _mm_or_si128(_mm_or_si128(                                            \
+    _mm_cmpeq_epi32(_mm_srli_epi32(p, 24),                              \
+                    _mm_set1_epi32(PixTop(PixTypeSpace))),              \
+    _mm_cmpeq_epi32(_mm_srli_epi32(p, 24),                              \
+                    _mm_set1_epi32(PixTop(PixTypeStar)))),              \
+  _mm_or_si128(                                                         \
+    _mm_cmpeq_epi32(_mm_srli_epi32(p, 24),                              \
+                    _mm_set1_epi32(PixTop(PixTypeGridLand))),           \
+    _mm_cmpeq_epi32(_mm_srli_epi32(p, 24),                              \
+                    _mm_set1_epi32(PixTop(PixTypeGridWater)))))
+
+/* Div255() in each 16-bit lane of x
+ */
+#define SSE2_DIV255(x)                                                  \
+  _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)),     \
+                               _mm_srli_epi16(x, 8)), 8)
+
+
+/* where a SIMD kernel that takes columns lo through hi-1 step at a
+ * time should hand over to a scalar one: it has to stop on a whole
+ * step, and leave at least slack columns (which its last stores can
+ * run over) to the scalar kernel
+ */
+static int simd_split(lo, hi, step, slack)
+     int lo;
+     int hi;
+     int step;
+     int slack;
+{
+  int n;
+
+  n = hi - lo - slack;
+  if (n <= 0)
+    return lo;
+
+  return lo + (n - (n % step));
+}
+
+
+/* fill in *c for a row that is y up from the equator (orthographic)
+ * or at latitude asin(y) (mercator and cylindrical); a is 1-y*y or
+ * sqrt(1-y*y), respectively
+ */
+static void simd_consts(job, y, a, c)
+     RenderJob   *job;
+     double       y;
+     double       a;
+     ShadeConsts *c;
+{
+  c->a         = a;
+  c->y_sol_1   = y * job->sol[1];
+  c->sol_0     = job->sol[0];
+  c->sol_2     = job->sol[2];
+  c->night_v   = night_val;
+  c->day_base  = day_val_base;
+  c->day_delta = day_val_delta;
+}
+
+
+/* turn the sun dot products in scale (two of them) into shading
+ * levels, the way orth_shade_row() does, and store them in rslt[i]
+ * and rslt[i+1]; packing them down to bytes with saturation takes
+ * care of the clamp to 255
+ */
+#define SSE2_LEVELS(scale, c, rslt, i)                                  \
+  do {                                                                  \
+    __m128d night_;                                                     \
+    __m128d val_;                                                       \
+    __m128i lvl_;                                                       \
+    int     k_;                                                         \
+                                                                        \
+    night_ = _mm_cmplt_pd(scale, _mm_setzero_pd());                     \
+    val_   = _mm_add_pd(_mm_set1_pd((c)->day_base),                     \
+                        _mm_mul_pd(scale, _mm_set1_pd((c)->day_delta))); \
+    val_   = _mm_or_pd(_mm_and_pd(night_, _mm_set1_pd((c)->night_v)),   \
+                       _mm_andnot_pd(night_, val_));                    \
+    lvl_   = _mm_cvttpd_epi32(val_);                                    \
+    lvl_   = _mm_packs_epi32(lvl_, lvl_);                               \
+    lvl_   = _mm_packus_epi16(lvl_, lvl_);                              \
+    k_     = _mm_cvtsi128_si32(lvl_);                                   \
+    (rslt)[i]   = (u_char) k_;                                          \
+    (rslt)[i+1] = (u_char) (k_ >> 8);                                   \
+  } while (0)
+
+
+/* shading levels for n (even) pixels of an orthographic row, with
+ * inverse x coordinates inv_x[] (see orth_compute_levels())
+ */
+static void sse2_orth_levels(inv_x, n, c, rslt)
+     double      *inv_x;
+     int          n;
+     ShadeConsts *c;
+     u_char      *rslt;
+{
+  int     i;
+  __m128d x, z;
+  __m128d scale;
+#ifndef USE_EXACT_SQRT
+  __m128d big, pos;
+  __m128d z_big, z_small;
+#endif
+
+  for (i=0; i<n; i+=2)
+  {
+    x = _mm_loadu_pd(inv_x + i);
+    z = _mm_sub_pd(_mm_set1_pd(c->a), _mm_mul_pd(x, x));
+
+    /* z = SQRT(z)
      */
-    tmp = (cos_theta * z) - (sin_theta * x);
-    x   = (sin_theta * z) + (cos_theta * x);
-    z   = tmp;
+#ifdef USE_EXACT_SQRT
+    z = _mm_and_pd(_mm_cmpgt_pd(z, _mm_setzero_pd()), _mm_sqrt_pd(z));
+#else
+    big     = _mm_cmpgt_pd(z, _mm_set1_pd(0.13));
+    pos     = _mm_cmpgt_pd(z, _mm_setzero_pd());
+    z_big   = _mm_mul_pd(_mm_set1_pd(-0.3751672414), z);
+    z_big   = _mm_mul_pd(_mm_add_pd(z_big, _mm_set1_pd(1.153263483)), z);
+    z_big   = _mm_add_pd(z_big, _mm_set1_pd(0.2219037586));
+    z_small = _mm_mul_pd(_mm_set1_pd(-9.637346154), z);
+    z_small = _mm_mul_pd(_mm_add_pd(z_small, _mm_set1_pd(3.56143)), z);
+    z_small = _mm_add_pd(z_small, _mm_set1_pd(0.065372935));
+    z       = _mm_or_pd(_mm_and_pd(big, z_big),
+                        _mm_and_pd(_mm_andnot_pd(big, pos), z_small));
+#endif /* USE_EXACT_SQRT */
+
+    scale = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(c->sol_0)),
+                       _mm_set1_pd(c->y_sol_1));
+    scale = _mm_add_pd(scale, _mm_mul_pd(z, _mm_set1_pd(c->sol_2)));
+    SSE2_LEVELS(scale, c, rslt, i);
+  }
+}
 
-    rslt += 3;
+
+/* shading levels for n (even) pixels of a mercator or cylindrical
+ * row, with lon_sol[] from compute_lon_sol()
+ */
+static void sse2_lon_levels(lon_sol, n, c, rslt)
+     double      *lon_sol;
+     int          n;
+     ShadeConsts *c;
+     u_char      *rslt;
+{
+  int     i;
+  __m128d scale;
+
+  for (i=0; i<n; i+=2)
+  {
+    scale = _mm_mul_pd(_mm_set1_pd(c->a), _mm_loadu_pd(lon_sol + i));
+    scale = _mm_add_pd(scale, _mm_set1_pd(c->y_sol_1));
+    SSE2_LEVELS(scale, c, rslt, i);
   }
 }
 
 
-static void cyl_shade_row(idx, scanbuf, sol, rslt)
-     int     idx;
+/* shade n (a multiple of four) pixels from scanbuf[] with levels[]
+ * into rslt[], like level_shade_row(); each pixel's RGB triple gets
+ * stored as four bytes, so this writes one byte past rslt[n*3-1]
+ * (see simd_split())
+ */
+static void sse2_apply_levels(scanbuf, levels, n, rslt)
      s8or32 *scanbuf;
-     double *sol;
+     u_char *levels;
+     int     n;
      u_char *rslt;
 {
-  int    i, i_lim;
-  int    scanbuf_val;
-  int    val;
-  double x, y, z;
-  double sin_theta;
-  double cos_theta;
-  double scale;
-  double tmp;
-  double y_sol_1;
+  int     i, j;
+  int     k;
+  __m128i p;
+  __m128i lvl;
+  __m128i lo, hi;
+  __m128i rgb;
+  __m128i zero;
+  __m128i byte;
+
+  zero = _mm_setzero_si128();
+  byte = _mm_set1_epi32(0xff);
+
+  for (i=0; i<n; i+=4)
+  {
+    p   = _mm_loadu_si128((__m128i *) (scanbuf + i));
+    lvl = _mm_setr_epi32(levels[i], levels[i+1], levels[i+2], levels[i+3]);
+    lvl = _mm_or_si128(lvl, SSE2_FLAT(p));
+    lvl = _mm_and_si128(lvl, _mm_set1_epi32(0xff));
 
-  y = INV_YPROJECT(idx);
-  y = INV_CYLINDRICAL_Y(y);
-
-  /* conceptually, on each iteration of the i loop, we want:
-   *
-   *   x = sin(INV_XPROJECT(i)) * sqrt(1 - (y*y));
-   *   z = cos(INV_XPROJECT(i)) * sqrt(1 - (y*y));
-   *
-   * computing this directly is rather expensive, however, so we only
-   * compute the first (i=0) pair of values directly; all other pairs
-   * (i>0) are obtained through successive rotations of the original
-   * pair (by inv_proj_scale radians).
-   */
+    /* spread each pixel's level over the four 16-bit lanes its
+     * bytes get unpacked into
+     */
+    lvl = _mm_or_si128(lvl, _mm_slli_epi32(lvl, 16));
+    lo  = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero),
+                          _mm_unpacklo_epi32(lvl, lvl));
+    hi  = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero),
+                          _mm_unpackhi_epi32(lvl, lvl));
+    rgb = _mm_packus_epi16(SSE2_DIV255(lo), SSE2_DIV255(hi));
+
+    /* swap the red and blue bytes of each pixel (leaving zero on
+     * top), and store them one pixel at a time
+     */
+    rgb = _mm_or_si128(_mm_or_si128(
+            _mm_and_si128(_mm_srli_epi32(rgb, 16), byte),
+            _mm_and_si128(rgb, _mm_slli_epi32(byte, 8))),
+          _mm_slli_epi32(_mm_and_si128(rgb, byte), 16));
+    for (j=0; j<4; j++)
+    {
+      k = _mm_cvtsi128_si32(rgb);
+      memcpy(rslt, &k, 4);
+      rgb   = _mm_srli_si128(rgb, 4);
+      rslt += 3;
+    }
+  }
+}
 
-  /* compute initial (x, z) values
-   */
-  tmp = sqrt(1 - (y*y));
-  x   = sin(INV_XPROJECT(0)) * tmp;
-  z   = cos(INV_XPROJECT(0)) * tmp;
+#endif /* SIMD_SSE2 */
 
-  /* compute rotation coefficients used
-   * to find subsequent (x, z) values
-   */
-  tmp = proj_info.inv_proj_scale;
-  sin_theta = sin(tmp);
-  cos_theta = cos(tmp);
 
-  /* save a little computation in the inner loop
-   */
-  y_sol_1 = y * sol[1];
+#ifdef SIMD_AVX2
 
-  /* use i_lim to encourage compilers to register loop limit
-   */
-  i_lim = wdth;
-  for (i=0; i<i_lim; i++)
+#define AVX2_FLAT(p)                                                    \
+  _mm256_or_si256(_mm256_or_si256(                                      \
+    _mm256_cmpeq_epi32(_mm256_srli_epi32(p, 24),                        \
+                       _mm256_set1_epi32(PixTop(PixTypeSpace))),        \
+    _mm256_cmpeq_epi32(_mm256_srli_epi32(p, 24),                        \
+                       _mm256_set1_epi32(PixTop(PixTypeStar)))),        \
+  _mm256_or_si256(                                                      \
+    _mm256_cmpeq_epi32(_mm256_srli_epi32(p, 24),                        \
+                       _mm256_set1_epi32(PixTop(PixTypeGridLand))),     \
+    _mm256_cmpeq_epi32(_mm256_srli_epi32(p, 24),                        \
+                       _mm256_set1_epi32(PixTop(PixTypeGridWater)))))
+
+#define AVX2_DIV255(x)                                                  \
+  _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x,                \
+                                       _mm256_set1_epi16(1)),           \
+                                     _mm256_srli_epi16(x, 8)), 8)
+
+/* like SSE2_LEVELS(), four at a time
+ */
+#define AVX2_LEVELS(scale, c, rslt, i)                                  \
+  do {                                                                  \
+    __m256d night_;                                                     \
+    __m256d val_;                                                       \
+    __m128i lvl_;                                                       \
+    int     k_;                                                         \
+                                                                        \
+    night_ = _mm256_cmp_pd(scale, _mm256_setzero_pd(), _CMP_LT_OQ);     \
+    val_   = _mm256_add_pd(_mm256_set1_pd((c)->day_base),               \
+                           _mm256_mul_pd(scale,                         \
+                                         _mm256_set1_pd((c)->day_delta))); \
+    val_   = _mm256_blendv_pd(val_, _mm256_set1_pd((c)->night_v), night_); \
+    lvl_   = _mm256_cvttpd_epi32(val_);                                 \
+    lvl_   = _mm_packs_epi32(lvl_, lvl_);                               \
+    lvl_   = _mm_packus_epi16(lvl_, lvl_);                              \
+    k_     = _mm_cvtsi128_si32(lvl_);                                   \
+    (rslt)[i]   = (u_char) k_;                                          \
+    (rslt)[i+1] = (u_char) (k_ >> 8);                                   \
+    (rslt)[i+2] = (u_char) (k_ >> 16);                                  \
+    (rslt)[i+3] = (u_char) (k_ >> 24);                                  \
+  } while (0)
+
+
+/* like sse2_orth_levels(), for n a multiple of four
+ */
+static void avx2_orth_levels(inv_x, n, c, rslt)
+     double      *inv_x;
+     int          n;
+     ShadeConsts *c;
+     u_char      *rslt;
+{
+  int     i;
+  __m256d x, z;
+  __m256d scale;
+#ifndef USE_EXACT_SQRT
+  __m256d big, pos;
+  __m256d z_big, z_small;
+#endif
+
+  for (i=0; i<n; i+=4)
   {
-    scanbuf_val = scanbuf[i];
+    x = _mm256_loadu_pd(inv_x + i);
+    z = _mm256_sub_pd(_mm256_set1_pd(c->a), _mm256_mul_pd(x, x));
+
+#ifdef USE_EXACT_SQRT
+    z = _mm256_and_pd(_mm256_cmp_pd(z, _mm256_setzero_pd(), _CMP_GT_OQ),
+                      _mm256_sqrt_pd(z));
+#else
+    big     = _mm256_cmp_pd(z, _mm256_set1_pd(0.13), _CMP_GT_OQ);
+    pos     = _mm256_cmp_pd(z, _mm256_setzero_pd(), _CMP_GT_OQ);
+    z_big   = _mm256_mul_pd(_mm256_set1_pd(-0.3751672414), z);
+    z_big   = _mm256_mul_pd(_mm256_add_pd(z_big,
+                                          _mm256_set1_pd(1.153263483)), z);
+    z_big   = _mm256_add_pd(z_big, _mm256_set1_pd(0.2219037586));
+    z_small = _mm256_mul_pd(_mm256_set1_pd(-9.637346154), z);
+    z_small = _mm256_mul_pd(_mm256_add_pd(z_small,
+                                          _mm256_set1_pd(3.56143)), z);
+    z_small = _mm256_add_pd(z_small, _mm256_set1_pd(0.065372935));
+    z       = _mm256_blendv_pd(_mm256_and_pd(pos, z_small), z_big, big);
+#endif /* USE_EXACT_SQRT */
+
+    scale = _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(c->sol_0)),
+                          _mm256_set1_pd(c->y_sol_1));
+    scale = _mm256_add_pd(scale,
+                          _mm256_mul_pd(z, _mm256_set1_pd(c->sol_2)));
+    AVX2_LEVELS(scale, c, rslt, i);
+  }
+}
 
-    switch (scanbuf_val)
-    {
-    case PixTypeSpace:
-    case PixTypeStar:
-    case PixTypeGridLand:
-    case PixTypeGridWater:
-      rslt[0] = PixRed(scanbuf_val);
-      rslt[1] = PixGreen(scanbuf_val);
-      rslt[2] = PixBlue(scanbuf_val);
-      break;
 
-    default:
-      scale = (x * sol[0]) + y_sol_1 + (z * sol[2]);
-      if (scale < 0)
-      {
-	val = night_val;
-      }
-      else
-      {
-	val = day_val_base + (scale * day_val_delta);
-	if (val > 255)
-	  val = 255;
-	else
-	  assert(val >= 0);
-      }
+/* like sse2_lon_levels(), for n a multiple of four
+ */
+static void avx2_lon_levels(lon_sol, n, c, rslt)
+     double      *lon_sol;
+     int          n;
+     ShadeConsts *c;
+     u_char      *rslt;
+{
+  int     i;
+  __m256d scale;
 
-      rslt[0] = PixRed(scanbuf_val) * val / 255;
-      rslt[1] = PixGreen(scanbuf_val) * val / 255;
-      rslt[2] = PixBlue(scanbuf_val) * val / 255;
-      break;
-    }
+  for (i=0; i<n; i+=4)
+  {
+    scale = _mm256_mul_pd(_mm256_set1_pd(c->a),
+                          _mm256_loadu_pd(lon_sol + i));
+    scale = _mm256_add_pd(scale, _mm256_set1_pd(c->y_sol_1));
+    AVX2_LEVELS(scale, c, rslt, i);
+  }
+}
 
-    /* compute next (x, z) values via 2-d rotation
-     */
-    tmp = (cos_theta * z) - (sin_theta * x);
-    x   = (sin_theta * z) + (cos_theta * x);
-    z   = tmp;
 
-    rslt += 3;
+/* like sse2_apply_levels(), for n a multiple of eight; the RGB
+ * triples get shuffled into place and stored sixteen bytes at a
+ * time, so this writes four bytes past rslt[n*3-1] (see
+ * simd_split())
+ */
+static void avx2_apply_levels(scanbuf, levels, n, rslt)
+     s8or32 *scanbuf;
+     u_char *levels;
+     int     n;
+     u_char *rslt;
+{
+  int     i;
+  __m256i p;
+  __m256i lvl;
+  __m256i lo, hi;
+  __m256i zero;
+  __m256i rgb;
+  __m256i order;
+
+  zero  = _mm256_setzero_si256();
+  order = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                           -1, -1, -1, -1,
+                           2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                           -1, -1, -1, -1);
+
+  for (i=0; i<n; i+=8)
+  {
+    p   = _mm256_loadu_si256((__m256i *) (scanbuf + i));
+    lvl = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (levels + i)));
+    lvl = _mm256_or_si256(lvl, AVX2_FLAT(p));
+    lvl = _mm256_and_si256(lvl, _mm256_set1_epi32(0xff));
+
+    lvl = _mm256_or_si256(lvl, _mm256_slli_epi32(lvl, 16));
+    lo  = _mm256_mullo_epi16(_mm256_unpacklo_epi8(p, zero),
+                             _mm256_unpacklo_epi32(lvl, lvl));
+    hi  = _mm256_mullo_epi16(_mm256_unpackhi_epi8(p, zero),
+                             _mm256_unpackhi_epi32(lvl, lvl));
+    rgb = _mm256_packus_epi16(AVX2_DIV255(lo), AVX2_DIV255(hi));
+    rgb = _mm256_shuffle_epi8(rgb, order);
+
+    _mm_storeu_si128((__m128i *) rslt, _mm256_castsi256_si128(rgb));
+    _mm_storeu_si128((__m128i *) (rslt + 12),
+                     _mm256_extracti128_si256(rgb, 1));
+    rslt += 24;
   }
 }
 
+#endif /* SIMD_AVX2 */
+
+
+#ifdef SIMD_SSE2
+
+/* template for the SIMD shading kernels (isa is sse2 or avx2, step
+ * is how many pixels isa_apply_levels() takes at a time, and slack
+ * how many columns it can run over; see simd_split())
+ */
+#define SIMD_SHADE_ROWS(isa, step, slack)                               \
+static void isa##_orth_shade_row(job, idx, lo, hi, scanbuf, rslt)       \
+     RenderJob *job;                                                    \
+     int        idx;                                                    \
+     int        lo;                                                     \
+     int        hi;                                                     \
+     s8or32    *scanbuf;                                                \
+     u_char    *rslt;                                                   \
+{                                                                       \
+  int         i, n, m;                                                  \
+  double      y;                                                        \
+  u_char      levels[SIMD_CHUNK];                                       \
+  ShadeConsts c;                                                        \
+                                                                        \
+  y = INV_YPROJECT(idx);                                                \
+  simd_consts(job, y, 1 - (y*y), &c);                                   \
+                                                                        \
+  m = simd_split(lo, hi, step, slack);                                  \
+  for (i=lo; i<m; i+=n)                                                 \
+  {                                                                     \
+    n = m - i;                                                          \
+    if (n > SIMD_CHUNK) n = SIMD_CHUNK;                                 \
+    isa##_orth_levels(job->inv_x + i, n, &c, levels);                   \
+    isa##_apply_levels(scanbuf + i, levels, n, rslt + i*3);             \
+  }                                                                     \
+                                                                        \
+  if (m < hi)                                                           \
+    orth_shade_row(job, idx, m, hi, scanbuf, rslt);                     \
+}                                                                       \
+                                                                        \
+static void isa##_level_shade_row(job, idx, lo, hi, scanbuf, rslt)      \
+     RenderJob *job;                                                    \
+     int        idx;                                                    \
+     int        lo;                                                     \
+     int        hi;                                                     \
+     s8or32    *scanbuf;                                                \
+     u_char    *rslt;                                                   \
+{                                                                       \
+  int m;                                                                \
+                                                                        \
+  m = simd_split(lo, hi, step, slack);                                  \
+  if (m > lo)                                                           \
+    isa##_apply_levels(scanbuf + lo, job->levels + (idx * wdth) + lo,   \
+                       m - lo, rslt + lo*3);                            \
+                                                                        \
+  if (m < hi)                                                           \
+    level_shade_row(job, idx, m, hi, scanbuf, rslt);                    \
+}                                                                       \
+                                                                        \
+static void isa##_new_level_shade_row(job, idx, lo, hi, scanbuf, rslt)  \
+     RenderJob *job;                                                    \
+     int        idx;                                                    \
+     int        lo;                                                     \
+     int        hi;                                                     \
+     s8or32    *scanbuf;                                                \
+     u_char    *rslt;                                                   \
+{                                                                       \
+  int         m;                                                        \
+  double      y;                                                        \
+  u_char     *levels;                                                   \
+  ShadeConsts c;                                                        \
+                                                                        \
+  y = INV_YPROJECT(idx);                                                \
+  simd_consts(job, y, 1 - (y*y), &c);                                   \
+  levels = job->levels + (idx * wdth);                                  \
+                                                                        \
+  m = simd_split(0, wdth, step, 0);                                     \
+  isa##_orth_levels(job->inv_x, m, &c, levels);                         \
+  orth_compute_levels(idx, m, wdth, job->sol, job->inv_x, levels);      \
+                                                                        \
+  isa##_level_shade_row(job, idx, lo, hi, scanbuf, rslt);               \
+}                                                                       \
+                                                                        \
+SIMD_LON_SHADE_ROW(isa##_merc_shade_row, isa, step, slack,              \
+                   INV_MERCATOR_Y, merc_shade_row)                      \
+SIMD_LON_SHADE_ROW(isa##_cyl_shade_row, isa, step, slack,               \
+                   INV_CYLINDRICAL_Y, cyl_shade_row)
+
+/* (and for the mercator and cylindrical ones, which only differ in
+ * INV_Y and the scalar kernel they hand the end of the row to)
+ */
+#define SIMD_LON_SHADE_ROW(name, isa, step, slack, INV_Y, tail)         \
+static void name(job, idx, lo, hi, scanbuf, rslt)                       \
+     RenderJob *job;                                                    \
+     int        idx;                                                    \
+     int        lo;                                                     \
+     int        hi;                                                     \
+     s8or32    *scanbuf;                                                \
+     u_char    *rslt;                                                   \
+{                                                                       \
+  int         i, n, m;                                                  \
+  double      y;                                                        \
+  u_char      levels[SIMD_CHUNK];                                       \
+  ShadeConsts c;                                                        \
+                                                                        \
+  y = INV_YPROJECT(idx);                                                \
+  y = INV_Y(y);                                                         \
+  simd_consts(job, y, sqrt(1 - (y*y)), &c);                             \
+                                                                        \
+  m = simd_split(lo, hi, step, slack);                                  \
+  for (i=lo; i<m; i+=n)                                                 \
+  {                                                                     \
+    n = m - i;                                                          \
+    if (n > SIMD_CHUNK) n = SIMD_CHUNK;                                 \
+    isa##_lon_levels(job->lon_sol + i, n, &c, levels);                  \
+    isa##_apply_levels(scanbuf + i, levels, n, rslt + i*3);             \
+  }                                                                     \
+                                                                        \
+  if (m < hi)                                                           \
+    tail(job, idx, m, hi, scanbuf, rslt);                               \
+}
+
+SIMD_SHADE_ROWS(sse2, 4, 1)
+#ifdef SIMD_AVX2
+SIMD_SHADE_ROWS(avx2, 8, 2)
+#endif
+
+#endif /* SIMD_SSE2 */
+
+
+/* the shading kernels for each of SimdNone, SimdSSE2 and SimdAVX2
+ * (as far as they are compiled in)
+ */
+static ShadeKernels shade_kernels[] =
+{
+  { orth_shade_row, level_shade_row, new_level_shade_row,
+    merc_shade_row, cyl_shade_row },
+#ifdef SIMD_SSE2
+  { sse2_orth_shade_row, sse2_level_shade_row, sse2_new_level_shade_row,
+    sse2_merc_shade_row, sse2_cyl_shade_row },
+#ifdef SIMD_AVX2
+  { avx2_orth_shade_row, avx2_level_shade_row, avx2_new_level_shade_row,
+    avx2_merc_shade_row, avx2_cyl_shade_row },
+#endif /* SIMD_AVX2 */
+#endif /* SIMD_SSE2 */
+};
+
 
 void render(rowfunc)
      int (*rowfunc) _P((u_char *));
 {
-  int     i, i_lim;
-  s8or32 *scanbuf;
-  u_char *row;
-  double *inv_x;
-  double  sol[3] = {0,0,0}; /* initialize to suppress spurious unused warning */
-  double  tmp;
-
-  scanbuf = (s8or32 *) malloc((unsigned) (sizeof(s8or32) * wdth));
-  row = (u_char *) malloc((unsigned) wdth*3);
-  assert((scanbuf != NULL) && (row != NULL));
+  int       i, i_lim;
+  int       nworkers;
+  int       nbatch;
+  double   *inv_x;
+  double   *lon_sol;
+  double    sol[3] = {0,0,0}; /* initialize to suppress spurious unused warning */
+  double    tmp;
+  RenderJob job;
+
+  /* no point in having more workers than bands of rows
+   */
+  nworkers = num_threads;
+  if (nworkers > (hght + RENDER_BAND-1) / RENDER_BAND)
+    nworkers = (hght + RENDER_BAND-1) / RENDER_BAND;
+  if (nworkers < 1) nworkers = 1;
+  nbatch = nworkers * RENDER_BATCH * RENDER_BAND;
+
+  job.scanbufs = (s8or32 **) malloc((unsigned) sizeof(s8or32 *) * nworkers);
+  job.rows     = (u_char *) malloc((unsigned) wdth*3*nbatch);
+  assert((job.scanbufs != NULL) && (job.rows != NULL));
+  for (i=0; i<nworkers; i++)
+  {
+    job.scanbufs[i] =
+      (s8or32 *) malloc((unsigned) (sizeof(s8or32) * (wdth+1)));
+    assert(job.scanbufs[i] != NULL);
+  }
   overlay_init();
 
-  inv_x = NULL;
+  inv_x   = NULL;
+  lon_sol = NULL;
+  nrenders += 1;
   render_rows_setup();
 
+  job.levels    = NULL;
+  job.levels_ok = 0;
+
   if (do_shade)
   {
-    /* inv_x[] only gets used with orthographic projection
+    compute_sun_vector(sol);
+
+    /* inv_x[] only gets used with orthographic projection, lon_sol[]
+     * with the others
      */
     if (proj_type == ProjTypeOrthographic)
     {
@@ -585,8 +1796,12 @@ void render(rowfunc)
       assert(inv_x != NULL);
       orth_compute_inv_x(inv_x);
     }
-
-    compute_sun_vector(sol);
+    else
+    {
+      lon_sol = (double *) malloc((unsigned) sizeof(double) * wdth);
+      assert(lon_sol != NULL);
+      compute_lon_sol(sol, lon_sol);
+    }
 
     /* precompute shading parameters
      */
@@ -594,45 +1809,246 @@ void render(rowfunc)
     tmp           = terminator / 100.0;
     day_val_base  = ((tmp * day) + ((1-tmp) * night))  * (255.99/100.0);
     day_val_delta = (day * (255.99/100.0)) - day_val_base;
+
+    /* in the orthographic projection, the shading level of each
+     * pixel only depends on where the sun is in view space; with
+     * -pos sunrel, that usually stays put from one render() to the
+     * next, so keep the levels around
+     */
+    if (proj_type == ProjTypeOrthographic)
+      job.levels = orth_shade_setup(sol, &(job.levels_ok));
   }
 
-  /* main render loop
-   * (use i_lim to encourage compilers to register loop limit)
+  job.sol     = sol;
+  job.inv_x   = inv_x;
+  job.lon_sol = lon_sol;
+
+  /* with -mapfile or -overlay, figure out where each pixel lands on
+   * the textures once, for all of them to use; if the view hasn't
+   * changed since last time, that may already be known
    */
-  i_lim = hght;
-  for (i=0; i<i_lim; i++)
+  job.tex_cols  = NULL;
+  job.coords    = NULL;
+  job.coords_ok = 0;
+  job.coordbufs = NULL;
+  ntexgroups    = 0;
+  if ((mapfile != NULL) || (overlayfile[0] != NULL))
+    job.coords = coords_setup(&(job.coords_ok));
+
+  if (ntexgroups > 0)
+  {
+    if (!job.coords_ok)
+    {
+      job.tex_cols = (double *) malloc((unsigned) sizeof(double) * 4 * wdth);
+      assert(job.tex_cols != NULL);
+      tex_cols_setup(job.tex_cols);
+    }
+
+    if (job.coords == NULL)
+    {
+      job.coordbufs = (TexCoord **) malloc((unsigned) sizeof(TexCoord *) *
+                                           nworkers);
+      assert(job.coordbufs != NULL);
+      for (i=0; i<nworkers; i++)
+      {
+        job.coordbufs[i] = (TexCoord *) malloc((unsigned) sizeof(TexCoord) *
+                                               ntexgroups * wdth);
+        assert(job.coordbufs[i] != NULL);
+      }
+    }
+  }
+
+  pick_kernels(&job);
+
+  /* main render loop: the workers render a batch of rows (each row
+   * depends only on the scanbits and dots for that row, so they can
+   * be done in any order), then the rows are passed on to rowfunc in
+   * order
+   */
+  for (job.lo_y=0; job.lo_y<hght; job.lo_y=job.hi_y)
   {
-    render_next_row(scanbuf, i);
+    job.hi_y = job.lo_y + nbatch;
+    if (job.hi_y > hght) job.hi_y = hght;
 
-    if (!do_shade)
-      no_shade_row(scanbuf, row);
-    else if (proj_type == ProjTypeOrthographic)
-      orth_shade_row(i, scanbuf, sol, inv_x, row);
-    else if (proj_type == ProjTypeMercator)
-      merc_shade_row(i, scanbuf, sol, row);
-    else /* (proj_type == ProjTypeCylindrical) */
-      cyl_shade_row(i, scanbuf, sol, row);
+    pool_deal(nworkers, (job.hi_y - job.lo_y + RENDER_BAND-1) / RENDER_BAND);
+    pool_run(nworkers, render_rows, (void *) &job);
 
-    rowfunc(row);
+    /* use i_lim to encourage compilers to register loop limit
+     */
+    i_lim = job.hi_y - job.lo_y;
+    for (i=0; i<i_lim; i++)
+      rowfunc(job.rows + (i * wdth*3));
   }
 
-  overlay_close();
-  free(scanbuf);
-  free(row);
+  for (i=0; i<nworkers; i++)
+    free(job.scanbufs[i]);
+  free(job.scanbufs);
+  free(job.rows);
 
   if (inv_x != NULL) free(inv_x);
+  if (lon_sol != NULL) free(lon_sol);
+  if (job.tex_cols != NULL) free(job.tex_cols);
+  if (job.coordbufs != NULL)
+  {
+    for (i=0; i<nworkers; i++)
+      free(job.coordbufs[i]);
+    free(job.coordbufs);
+  }
+}
+
+
+/* pick the row kernels render_rows() uses for this frame
+ */
+static void pick_kernels(job)
+     RenderJob *job;
+{
+  int           map;
+  int           overlay;
+  ShadeKernels *shade;
+
+  map     = (mapfile != NULL);
+  overlay = (overlayfile[0] != NULL);
+
+  if (ntexgroups == 0)
+    job->inverse = NULL;
+  else if (proj_type == ProjTypeOrthographic)
+    job->inverse = orth_coords_row;
+  else if (proj_type == ProjTypeMercator)
+    job->inverse = merc_coords_row;
+  else /* (proj_type == ProjTypeCylindrical) */
+    job->inverse = cyl_coords_row;
+
+  if (!map && !overlay)
+    job->source = scan_row;
+  else if (!overlay)
+    job->source = map_row;
+  else if (!map)
+    job->source = overlay_row;
+  else
+    job->source = map_overlay_row;
+
+  shade = &shade_kernels[simd_level()];
+  if (!do_shade)
+    job->shade = no_shade_row;
+  else if (proj_type == ProjTypeOrthographic)
+    job->shade = (job->levels == NULL) ? shade->orth
+               : job->levels_ok        ? shade->level
+               :                         shade->new_level;
+  else if (proj_type == ProjTypeMercator)
+    job->shade = shade->merc;
+  else /* (proj_type == ProjTypeCylindrical) */
+    job->shade = shade->cyl;
+}
+
+
+/* pool_run() callback; worker idx takes bands of rows from the
+ * current batch (its own share first, then ones stolen from other
+ * workers) and renders them until there are none left
+ */
+static void render_rows(idx, arg)
+     int   idx;
+     void *arg;
+{
+  int        i, i_lim;
+  int        lo, hi;
+  int        band;
+  s8or32    *scanbuf;
+  u_char    *row;
+  TexCoord  *tc;
+  RenderJob *job;
+
+  job     = (RenderJob *) arg;
+  scanbuf = job->scanbufs[idx];
+
+  while ((band = pool_next(idx)) >= 0)
+  {
+    i     = job->lo_y + (band * RENDER_BAND);
+    i_lim = i + RENDER_BAND;
+    if (i_lim > job->hi_y) i_lim = job->hi_y;
+
+    for (; i<i_lim; i++)
+    {
+      row = job->rows + ((i - job->lo_y) * wdth*3);
+
+      /* rows and columns outside the globe are just space and dots
+       * (see render_rows_setup()), so don't bother with shading
+       * them
+       */
+      if (space_rows && (scanbit_row[i] == scanbit_row[i+1]))
+      {
+        if (!job->levels_ok && (job->levels != NULL))
+          orth_compute_levels(i, 0, wdth, job->sol, job->inv_x,
+                              job->levels + (i * wdth));
+        space_row(scanbuf, i, row);
+        continue;
+      }
+
+      /* the texture coordinates of each pixel (if needed) go in the
+       * cache or, if there isn't one, the worker's own row
+       */
+      tc = NULL;
+      if (job->inverse != NULL)
+      {
+        if (job->coords != NULL)
+          tc = job->coords + (i * wdth * ntexgroups);
+        else
+          tc = job->coordbufs[idx];
+
+        if (!job->coords_ok)
+          job->inverse(job, i, tc);
+      }
+
+      job->source(scanbuf, i, tc);
+      render_dots(scanbuf, i);
+
+      lo = globe_lo_x;
+      hi = globe_hi_x;
+      no_shade_row(job, i, 0, lo, scanbuf, row);
+      no_shade_row(job, i, hi, wdth, scanbuf, row);
+      job->shade(job, i, lo, hi, scanbuf, row);
+    }
+  }
 }
 
 
 void do_dots()
 {
+  unsigned n;
+
   if (dots == NULL)
     dots = extarr_alloc(sizeof(ScanDot));
   else
     dots->count = 0;
 
   if (do_stars) new_stars(star_freq);
-  if (do_grid) new_grid(grid_big, grid_small);
+
+  /* the grid only depends on the view, so if scan_map() found that
+   * hasn't changed, neither has the grid; copy it from last time.
+   * (stars and the label are redone every time.)
+   */
+  if (do_grid)
+  {
+    if (grid_dots == NULL)
+      grid_dots = extarr_alloc(sizeof(ScanDot));
+
+    if (scan_reused && (grid_dots->count > 0))
+    {
+      n = grid_dots->count;
+      memcpy(extarr_extend(dots, n), grid_dots->body, n * sizeof(ScanDot));
+    }
+    else
+    {
+      n = dots->count;
+      new_grid(grid_big, grid_small);
+
+      grid_dots->count = 0;
+      if (dots->count > n)
+        memcpy(extarr_extend(grid_dots, dots->count - n),
+               ((ScanDot *) dots->body) + n,
+               (dots->count - n) * sizeof(ScanDot));
+    }
+  }
+
   if (do_label) new_label();
 
   qsort(dots->body, dots->count, sizeof(ScanDot), dot_comp);
@@ -46,7 +46,27 @@
 #include "xearth.h"
 #include "kljcpyrt.h"
 
-#define MAP_DATA_SCALE (30000)
+/* level-of-detail parameters: level 1 is simplified to within
+ * LOD_TOLERANCE (a distance on the unit sphere) of map_data, and
+ * each level after that to twice the tolerance of the one before.
+ * scan_map() uses the coarsest level whose tolerance comes to no
+ * more than LOD_MAX_ERROR pixels on screen.
+ */
+#define LOD_LEVELS    (7)
+#define LOD_TOLERANCE (0.001)
+#define LOD_MAX_ERROR (0.5)
+
+/* points per chunk in the second level of bounding caps; when only
+ * part of the globe (or map) is on screen, orth_scan_curves(),
+ * merc_scan_curves() and cyl_scan_curves() skip chunks whose caps
+ * lie entirely off screen
+ */
+#define CHUNK_POINTS  (16)
+
+/* scan() clips edges to the screen plus this many pixels on either
+ * side (see ScanState.clip_lo_x and clip_hi_x)
+ */
+#define CLIP_GUARD    (2)
 
 #define XingTypeEntry (0)
 #define XingTypeExit  (1)
@@ -59,75 +79,221 @@ typedef struct
   double angle;
 } EdgeXing;
 
+/* a spherical cap centered on {x,y,z} with angular radius r
+ */
+typedef struct
+{
+  double x, y, z;               /* center (unit vector)   */
+  double cos_r, sin_r;          /* cos/sin of radius      */
+} MapCap;
+
+/* a curve from map_data, after decoding; its points are
+ * map_{x,y,z}[first] through map_{x,y,z}[first+npts-1]. all of the
+ * points (and so everything the curve encloses) lie within cap.
+ *
+ * the points are also split into runs of CHUNK_POINTS (the last one
+ * possibly shorter), each with a cap of its own (chunks[first_chunk]
+ * onward) covering its points and the first point of the next run;
+ * that is, every segment of the run and the one leaving it.
+ */
+typedef struct
+{
+  int    npts;                  /* number of points in curve */
+  int    val;                   /* value for get_scanbits()  */
+  int    first;                 /* index of first point      */
+  int    first_chunk;           /* index of first chunk cap  */
+  MapCap cap;                   /* bounding cap              */
+} MapCurve;
+
+/* one level of detail; level 0 is map_data itself, the others are
+ * copies simplified (with the Douglas-Peucker algorithm) to within
+ * tol of it, minus any curves that shrink to less than a triangle
+ */
+typedef struct
+{
+  double    tol;                /* max error (unit sphere distance) */
+  int       ncurves;            /* number of curves                 */
+  MapCurve *curves;             /* the curves                       */
+  int       npoints;            /* total number of points           */
+  float    *x, *y, *z;          /* points (unit vectors)            */
+  double    max_sag;            /* max distance of a curve segment  */
+                                /*  (chord) inside the unit sphere  */
+  MapCap   *chunks;             /* caps for runs of CHUNK_POINTS    */
+} MapLevel;
+
+/* everything the results of scan_map() depend on; if none of it
+ * has changed since the last pass, the scanbits can be reused
+ */
+typedef struct
+{
+  int    proj_type;
+  double view_lat, view_lon;
+  double view_rot;
+  double view_mag;
+  int    wdth, hght;
+  int    shift_x, shift_y;
+} ScanKey;
+
+/* a pair of edge intercepts from get_scanbits(), before rounding
+ * to pixels and clipping to the screen
+ */
+typedef struct
+{
+  int    y;
+  int    val;
+  double lo_x, hi_x;
+} ScanSpan;
+
+/* an edge in the scanline edge table; x is the intercept with the
+ * current row (the first row the edge crosses, until get_scanbits()
+ * starts stepping it) and dx the change in x from one row to the next
+ */
+typedef struct
+{
+  double x;
+  double dx;
+  int    hi_y;                  /* last row crossed by edge */
+  int    next;                  /* next edge in same bucket */
+} ScanEdge;
+
+/* everything a single scan worker writes to while converting a
+ * range of curves; with -threads, each worker gets its own so that
+ * curves can be scanned concurrently
+ */
+typedef struct
+{
+  ExtArr  scanbits;             /* scanbits produced by this worker */
+  ExtArr  edgexings;            /* edge crossings for current curve */
+  ExtArr  edges;                /* edge table for current curve     */
+  ExtArr  active;               /* active edge list (indices)       */
+  ExtArr  spans;                /* spans, if raw_spans is set       */
+  ExtArr  skip;                 /* chunks skipped in current curve  */
+  int     raw_spans;            /* get_scanbits() to spans instead? */
+  int    *edge_row;             /* first edge starting on each row  */
+  char   *left_flip;            /* rows where left parity flips     */
+  int     nrows;                /* number of rows in edge_row       */
+  double  clip_lo_x, clip_hi_x; /* x range scan() clips edges to    */
+  int     min_y, max_y;         /* rows touched by current curve    */
+  int     lo_curve, hi_curve;   /* range of curves to scan          */
+  int     xing_bad;             /* edge crossings didn't pair up?   */
+} ScanState;
+
 void    scan_map _P((void));
-void    orth_scan_outline _P((void));
-void    orth_scan_curves _P((void));
-double *orth_extract_curve _P((int, short *));
-void    orth_scan_along_curve _P((double *, double *, int));
+void    scan_curves _P((int, void *));
+void    orth_scan_outline _P((ScanState *));
+void    orth_scan_curves _P((ScanState *));
+void    orth_extract_points _P((int, int));
+void    orth_scan_along_curve _P((ScanState *, double *, double *, int));
 void    orth_find_edge_xing _P((double *, double *, double *));
-void    orth_handle_xings _P((void));
-void    orth_scan_arc _P((double, double, double, double, double, double));
-void    merc_scan_outline _P((void));
-void    merc_scan_curves _P((void));
-double *merc_extract_curve _P((int, short *));
-void    merc_scan_along_curve _P((double *, double *, int));
+void    orth_handle_xings _P((ScanState *));
+void    orth_scan_arc _P((ScanState *, double, double, double, double, double,
+                          double));
+void    merc_scan_outline _P((ScanState *));
+void    merc_scan_curves _P((ScanState *));
+void    merc_extract_points _P((int, int));
+void    merc_scan_along_curve _P((ScanState *, double *, double *, int));
 double  merc_find_edge_xing _P((double *, double *));
-void    merc_handle_xings _P((void));
-void    merc_scan_edge _P((EdgeXing *, EdgeXing *));
-void    cyl_scan_outline _P((void));
-void    cyl_scan_curves _P((void));
-double *cyl_extract_curve _P((int, short *));
-void    cyl_scan_along_curve _P((double *, double *, int));
+void    merc_handle_xings _P((ScanState *));
+void    merc_scan_edge _P((ScanState *, EdgeXing *, EdgeXing *));
+void    cyl_scan_outline _P((ScanState *));
+void    cyl_scan_curves _P((ScanState *));
+void    cyl_extract_points _P((int, int));
+void    cyl_scan_along_curve _P((ScanState *, double *, double *, int));
 double  cyl_find_edge_xing _P((double *, double *));
-void    cyl_handle_xings _P((void));
-void    cyl_scan_edge _P((EdgeXing *, EdgeXing *));
-void    xing_error _P((const char *, int, int, int, EdgeXing *));
-void    scan _P((double, double, double, double));
-void    get_scanbits _P((int));
-
-static int double_comp _P((const void *, const void *));
-static int scanbit_comp _P((const void *, const void *));
+void    cyl_handle_xings _P((ScanState *));
+void    cyl_scan_edge _P((ScanState *, EdgeXing *, EdgeXing *));
+void    xing_error _P((ScanState *, const char *, int, int, int,
+                           EdgeXing *));
+void    scan _P((ScanState *, double, double, double, double));
+void    get_scanbits _P((ScanState *, int));
+void    clear_edges _P((ScanState *));
+
+static int scanspan_comp _P((const void *, const void *));
 static int orth_edgexing_comp _P((const void *, const void *));
 static int merc_edgexing_comp _P((const void *, const void *));
 static int cyl_edgexing_comp _P((const void *, const void *));
+static void *alloc_aligned _P((unsigned));
+static void decode_map_data _P((void));
+static void bound_curve _P((MapLevel *, MapCurve *));
+static void bound_cap _P((MapLevel *, MapCurve *, int, int, MapCap *));
+static void bound_chunks _P((MapLevel *));
+static int  cap_off_screen _P((MapCap *, double *));
+static int  lon_cap_off_screen _P((MapCap *, double *));
+static char *lon_skip_chunks _P((ScanState *, MapCurve *, int, double *));
+static int  lon_bounds _P((ScanState *, double *));
+static void build_level _P((MapLevel *, MapLevel *, double));
+static int bad_ring _P((MapLevel *, MapCurve *, char *, int *, double *));
+static double ring_area _P((MapLevel *, int *, int, MapCap *));
+static void simplify_curve _P((MapLevel *, MapCurve *, int, int, double,
+                               char *));
+static void select_level _P((void));
+static void use_level _P((int));
+static int  xings_bad _P((int));
+static void compute_xform _P((void));
+static void xform_points _P((int, int, int));
+static void setup_states _P((int));
+static void get_scan_key _P((ScanKey *));
+static int  same_scan_key _P((ScanKey *, ScanKey *));
+static int  scan_key_changed _P((void));
+static int  use_lon_spans _P((int));
+static int  scan_lon_spans _P((int));
+static void add_scanbit _P((ExtArr, int, double, double, int));
+static void bucket_scanbits _P((int));
 
 ViewPosInfo view_pos_info;
 ProjInfo    proj_info;
 
-int     first_scan = 1;
-ExtArr  scanbits;
-ExtArr  edgexings;
-int     min_y, max_y;
-ExtArr *scanbuf;
-
-
-static int double_comp(a, b)
-     const void *a;
-     const void *b;
-{
-  double val_a;
-  double val_b;
-  int    rslt;
-
-  val_a = *((const double *) a);
-  val_b = *((const double *) b);
+ExtArr     scanbits;
+int       *scanbit_row = NULL;  /* first scanbit for each row      */
+int        scan_reused;         /* last scan_map() reused scanbits? */
 
-  if (val_a < val_b)
-    rslt = -1;
-  else if (val_a > val_b)
-    rslt = 1;
-  else
-    rslt = 0;
+static int        nscanbit_row = 0; /* rows in scanbit_row        */
+static ScanKey    scan_key;     /* view for current scanbits       */
+static int        scan_passes = 0; /* scan_map() calls so far      */
+static int        scan_hits = 0;   /* ... and ones that reused     */
 
-  return rslt;
-}
+/* in the mercator and cylindrical projections, as long as view_lat
+ * and view_rot are zero, changing view_lon just slides the image
+ * sideways; lon_spans holds the curves' spans for view_lon = 0 (with
+ * the ones split at +/-180 degrees joined back up), from which the
+ * scanbits for any other view_lon can be had by shifting
+ */
+static ExtArr     lon_spans = NULL; /* spans for view_lon = 0      */
+static ScanKey    lon_key;      /* view lon_spans were made for    */
+static int        lon_spans_ok = 0; /* lon_spans usable?           */
 
+static MapLevel   levels[LOD_LEVELS];
+static int        scan_level;   /* level being scanned             */
 
-static int scanbit_comp(a, b)
+/* the level of detail being scanned in the current pass (copied
+ * from levels[] by select_level())
+ */
+static int        ncurves;      /* number of curves                */
+static MapCurve  *curves;       /* decoded curves                  */
+static int        npoints;      /* total number of points          */
+static float     *map_x;        /* decoded points (unit vectors),  */
+static float     *map_y;        /*  stored as a structure of       */
+static float     *map_z;        /*  arrays                         */
+static double     max_sag;      /* max distance of a curve segment */
+                                /*  (chord) inside the unit sphere */
+static MapCap    *chunks;       /* chunk caps                      */
+
+static double    *xformed = NULL; /* rotated/projected points      */
+static int        nstates = 0;  /* number of scan states allocated */
+static ScanState *states;       /* one per scan worker */
+
+
+static int scanspan_comp(a, b)
      const void *a;
      const void *b;
 {
-  return (((const ScanBit *) a)->y - ((const ScanBit *) b)->y);
+  const ScanSpan *s1 = (const ScanSpan *) a;
+  const ScanSpan *s2 = (const ScanSpan *) b;
+
+  if (s1->y != s2->y)
+    return (s1->y - s2->y);
+  else
+    return (s1->val - s2->val);
 }
 
 
@@ -263,7 +429,7 @@ static int cyl_edgexing_comp(a, b)
 
 void scan_map()
 {
-  int          i;
+  int          nworkers;
   ViewPosInfo *vpi;
   ProjInfo    *pi;
 
@@ -291,153 +457,1467 @@ void scan_map()
   pi->proj_yofs      = (double) hght / 2 + shift_y;
   pi->inv_proj_scale = 1 / pi->proj_scale;
 
-  /* the first time through, allocate scanbits and edgexings;
-   * on subsequent passes, simply reset them.
+  compute_xform();
+
+  /* if the view is the same as last time, the scanbits we already
+   * have are just what we would compute
+   */
+  scan_passes += 1;
+  scan_reused  = !scan_key_changed();
+  if (scan_reused)
+  {
+    scan_hits += 1;
+    if (verbose)
+      fprintf(stderr, "xearth: view unchanged, reusing scan (%d of %d)\n",
+              scan_hits, scan_passes);
+    return;
+  }
+
+  /* the first time through, decode map_data and allocate scanbits
+   */
+  if (xformed == NULL)
+  {
+    decode_map_data();
+    scanbits = extarr_alloc(sizeof(ScanBit));
+  }
+
+  select_level();
+
+  for (;;)
+  {
+    /* no point in having more workers than curves
+     */
+    nworkers = num_threads;
+    if (nworkers > ncurves) nworkers = ncurves;
+    if (nworkers < 1) nworkers = 1;
+    setup_states(nworkers);
+
+    /* the outline always goes first (and to the first worker)
+     */
+    if (proj_type == ProjTypeOrthographic)
+      orth_scan_outline(&(states[0]));
+    else if (proj_type == ProjTypeMercator)
+      merc_scan_outline(&(states[0]));
+    else /* (proj_type == ProjTypeCylindrical) */
+      cyl_scan_outline(&(states[0]));
+
+    if (!use_lon_spans(nworkers))
+      pool_run(nworkers, scan_curves, (void *) states);
+
+    if (!xings_bad(nworkers))
+      break;
+
+    /* see xing_error()
+     */
+    if (verbose)
+      fprintf(stderr, "xearth: simplified coastlines didn't scan, "
+              "using full detail\n");
+    use_level(0);
+  }
+
+  bucket_scanbits(nworkers);
+}
+
+
+/* gather the scanbits from the first nworkers scan states into
+ * scanbits, grouped by row (a counting sort), and fill in
+ * scanbit_row: the scanbits for row y are scanbits[scanbit_row[y]]
+ * up to (but not including) scanbits[scanbit_row[y+1]]. within a
+ * row, the scanbits are in worker order; since each worker handles
+ * a contiguous range of curves, that is exactly the order a single
+ * worker would have produced them in.
+ */
+static void bucket_scanbits(nworkers)
+     int nworkers;
+{
+  int      i, j;
+  int      n;
+  int      total;
+  int     *row;
+  ScanBit *src;
+  ScanBit *dst;
+
+  if (nscanbit_row < hght+1)
+  {
+    scanbit_row = (int *) realloc(scanbit_row, sizeof(int) * (hght+1));
+    assert(scanbit_row != NULL);
+    nscanbit_row = hght+1;
+  }
+
+  /* count the scanbits in each row (into row[y+1]), then add those
+   * up so that row[y] is where the scanbits for row y start
+   */
+  row = scanbit_row;
+  xearth_bzero((char *) row, (unsigned) (sizeof(int) * (hght+1)));
+  total = 0;
+  for (i=0; i<nworkers; i++)
+  {
+    src = (ScanBit *) states[i].scanbits->body;
+    n   = states[i].scanbits->count;
+    for (j=0; j<n; j++)
+      row[src[j].y+1] += 1;
+    total += n;
+  }
+  for (j=0; j<hght; j++)
+    row[j+1] += row[j];
+
+  /* drop each scanbit into place, advancing row[y] as we go; that
+   * leaves row[y] where row y+1 starts, so shift it back afterwards
+   */
+  scanbits->count = 0;
+  dst = (ScanBit *) extarr_extend(scanbits, (unsigned) total);
+  for (i=0; i<nworkers; i++)
+  {
+    src = (ScanBit *) states[i].scanbits->body;
+    n   = states[i].scanbits->count;
+    for (j=0; j<n; j++)
+      dst[row[src[j].y]++] = src[j];
+  }
+  for (j=hght; j>0; j--)
+    row[j] = row[j-1];
+  row[0] = 0;
+}
+
+
+/* did any of the first nworkers scan states run into edge crossings
+ * that didn't pair up? (clears the flags)
+ */
+static int xings_bad(nworkers)
+     int nworkers;
+{
+  int i;
+  int rslt;
+
+  rslt = 0;
+  for (i=0; i<nworkers; i++)
+  {
+    if (states[i].xing_bad)
+      rslt = 1;
+    states[i].xing_bad = 0;
+  }
+
+  return rslt;
+}
+
+
+/* fill in key for the current view
+ */
+static void get_scan_key(key)
+     ScanKey *key;
+{
+  key->proj_type = proj_type;
+  key->view_lat  = view_lat;
+  key->view_lon  = view_lon;
+  key->view_rot  = view_rot;
+  key->view_mag  = view_mag;
+  key->wdth      = wdth;
+  key->hght      = hght;
+  key->shift_x   = shift_x;
+  key->shift_y   = shift_y;
+}
+
+
+static int same_scan_key(k1, k2)
+     ScanKey *k1;
+     ScanKey *k2;
+{
+  return ((k1->proj_type == k2->proj_type) &&
+          (k1->view_lat == k2->view_lat) &&
+          (k1->view_lon == k2->view_lon) &&
+          (k1->view_rot == k2->view_rot) &&
+          (k1->view_mag == k2->view_mag) &&
+          (k1->wdth == k2->wdth) &&
+          (k1->hght == k2->hght) &&
+          (k1->shift_x == k2->shift_x) &&
+          (k1->shift_y == k2->shift_y));
+}
+
+
+/* compare the current view against scan_key (updating it); returns
+ * non-zero if it is different or if there's been no scan yet
+ */
+static int scan_key_changed()
+{
+  int     rslt;
+  ScanKey key;
+
+  get_scan_key(&key);
+  rslt     = ((xformed == NULL) || !same_scan_key(&key, &scan_key));
+  scan_key = key;
+
+  return rslt;
+}
+
+
+/* if the view is one that lon_spans can be used for, (re)compute
+ * lon_spans if need be, then add scanbits for the curves to the
+ * first worker's by shifting them over to view_lon. returns zero if the
+ * curves need to be scanned the usual way instead.
+ */
+static int use_lon_spans(nworkers)
+     int nworkers;
+{
+  int       i;
+  double    d;
+  double    a, b;
+  double    left, right;
+  double    width;
+  ExtArr    bits;
+  ScanKey   key;
+  ScanSpan *span;
+
+  if ((proj_type == ProjTypeOrthographic) ||
+      (view_lat != 0) || (view_rot != 0))
+    return 0;
+
+  get_scan_key(&key);
+  key.view_lon = 0;
+  if ((lon_spans == NULL) || !same_scan_key(&key, &lon_key))
+  {
+    lon_spans_ok = scan_lon_spans(nworkers);
+    lon_key      = key;
+  }
+
+  if (!lon_spans_ok)
+    return 0;
+
+  left  = XPROJECT(-M_PI);
+  right = XPROJECT(M_PI);
+  width = right - left;
+  d     = - view_lon * (M_PI/180) * proj_info.proj_scale;
+  bits  = states[0].scanbits;
+
+  span = (ScanSpan *) lon_spans->body;
+  for (i=0; i<lon_spans->count; i++)
+  {
+    if ((span[i].lo_x == left) && (span[i].hi_x == right))
+    {
+      /* all the way around */
+      add_scanbit(bits, span[i].y, left, right, span[i].val);
+      continue;
+    }
+
+    /* shift, wrap back into [left, right), and split wherever the
+     * span crosses the right edge
+     */
+    a = span[i].lo_x + d;
+    b = span[i].hi_x + d;
+    while (a >= right)
+    {
+      a -= width;
+      b -= width;
+    }
+    while (a < left)
+    {
+      a += width;
+      b += width;
+    }
+
+    while (b > right)
+    {
+      add_scanbit(bits, span[i].y, a, right, span[i].val);
+      a  = left;
+      b -= width;
+    }
+    add_scanbit(bits, span[i].y, a, b, span[i].val);
+  }
+
+  return 1;
+}
+
+
+/* scan the curves for view_lon = 0 into lon_spans, and join up the
+ * spans that were split at +/-180 degrees. returns zero if that
+ * didn't work out (so lon_spans can't be used).
+ */
+static int scan_lon_spans(nworkers)
+     int nworkers;
+{
+  int         i, j, k;
+  int         lo, hi;
+  unsigned    n;
+  double      left, right;
+  ScanSpan   *span;
+  ViewPosInfo save;
+
+  if (lon_spans == NULL)
+    lon_spans = extarr_alloc(sizeof(ScanSpan));
+  lon_spans->count = 0;
+
+  save = view_pos_info;
+  view_pos_info.cos_lon = 1;
+  view_pos_info.sin_lon = 0;
+  compute_xform();
+
+  /* the spans get shifted (and wrapped) later, so only clip them
+   * to the width of the whole map
+   */
+  for (i=0; i<nworkers; i++)
+  {
+    states[i].spans->count = 0;
+    states[i].raw_spans    = 1;
+    states[i].clip_lo_x    = XPROJECT(-M_PI) - CLIP_GUARD;
+    states[i].clip_hi_x    = XPROJECT(M_PI) + CLIP_GUARD;
+  }
+
+  pool_run(nworkers, scan_curves, (void *) states);
+
+  for (i=0; i<nworkers; i++)
+  {
+    states[i].raw_spans = 0;
+    states[i].clip_lo_x = -CLIP_GUARD;
+    states[i].clip_hi_x = wdth + CLIP_GUARD;
+    n = states[i].spans->count;
+    if (n > 0)
+      memcpy(extarr_extend(lon_spans, n), states[i].spans->body,
+             n * sizeof(ScanSpan));
+  }
+
+  view_pos_info = save;
+
+  if (xings_bad(nworkers))
+    return 0;
+
+  /* within each row, pair up spans of the same value ending at the
+   * right edge with ones starting at the left edge (how they are
+   * paired doesn't matter), joining the left one onto the end of the
+   * right one, and dropping the left one
+   */
+  left  = XPROJECT(-M_PI);
+  right = XPROJECT(M_PI);
+  span  = (ScanSpan *) lon_spans->body;
+  qsort(span, lon_spans->count, sizeof(ScanSpan), scanspan_comp);
+
+  for (lo=0; lo<lon_spans->count; lo=hi)
+  {
+    for (hi=lo; hi<lon_spans->count; hi++)
+      if ((span[hi].y != span[lo].y) || (span[hi].val != span[lo].val))
+        break;
+
+    k = lo;
+    for (i=lo; i<hi; i++)
+    {
+      if ((span[i].lo_x == left) || (span[i].hi_x != right))
+        continue;
+
+      for (; k<hi; k++)
+        if ((span[k].lo_x == left) && (span[k].hi_x != right))
+          break;
+      if (k == hi)
+        return 0;
+
+      span[i].hi_x = span[k].hi_x + (right - left);
+      span[k].val  = 0;
+      k += 1;
+    }
+
+    for (; k<hi; k++)
+      if ((span[k].lo_x == left) && (span[k].hi_x != right))
+        return 0;
+  }
+
+  /* squeeze out the dropped spans
+   */
+  j = 0;
+  for (i=0; i<lon_spans->count; i++)
+    if (span[i].val != 0)
+      span[j++] = span[i];
+  lon_spans->count = j;
+
+  return 1;
+}
+
+
+/* malloc() size bytes, aligned to a (64-byte) cache line; the
+ * memory is kept for the life of the process, so it never needs to
+ * be passed to free()
+ */
+static void *alloc_aligned(size)
+     unsigned size;
+{
+  char *rslt;
+
+  rslt = (char *) malloc(size + 63);
+  assert(rslt != NULL);
+
+  return (void *) (rslt + ((64 - (((unsigned long) rslt) & 63)) & 63));
+}
+
+
+/* decode the delta-encoded curves in map_data into unit vectors
+ * (level 0), once, and allocate the buffer the per-pass
+ * rotated/projected points are kept in. if a binary map data file
+ * was given (-mapdata), its points are used as is instead.
+ */
+static void decode_map_data()
+{
+  int        i, j;
+  int        x, y, z;
+  int        idx;
+  double     scale;
+  short     *raw;
+  MapLevel  *lvl;
+  MapBinData data;
+
+  lvl = &(levels[0]);
+  lvl->tol     = 0;
+  lvl->ncurves = 0;
+  lvl->npoints = 0;
+  lvl->max_sag = 0;
+
+  if (mapdatafile != NULL)
+  {
+    mapbin_load(mapdatafile, &data);
+
+    lvl->ncurves = data.ncurves;
+    lvl->npoints = data.npoints;
+    lvl->curves  = (MapCurve *) malloc((unsigned) sizeof(MapCurve) *
+                                       lvl->ncurves);
+    assert(lvl->curves != NULL);
+    lvl->x  = data.x;
+    lvl->y  = data.y;
+    lvl->z  = data.z;
+    xformed = (double *) alloc_aligned((unsigned) sizeof(double) * 5 *
+                                       lvl->npoints);
+
+    idx = 0;
+    for (i=0; i<lvl->ncurves; i++)
+    {
+      lvl->curves[i].npts  = data.curves[i].npts;
+      lvl->curves[i].val   = data.curves[i].val;
+      lvl->curves[i].first = idx;
+      idx += data.curves[i].npts;
+
+      bound_curve(lvl, &(lvl->curves[i]));
+    }
+    bound_chunks(lvl);
+
+    return;
+  }
+
+  for (raw=map_data; raw[0]!=0; raw+=2+3*raw[0])
+  {
+    lvl->ncurves += 1;
+    lvl->npoints += raw[0];
+  }
+
+  lvl->curves = (MapCurve *) malloc((unsigned) sizeof(MapCurve) *
+                                    lvl->ncurves);
+  assert(lvl->curves != NULL);
+  lvl->x  = (float *) alloc_aligned((unsigned) sizeof(float) * lvl->npoints);
+  lvl->y  = (float *) alloc_aligned((unsigned) sizeof(float) * lvl->npoints);
+  lvl->z  = (float *) alloc_aligned((unsigned) sizeof(float) * lvl->npoints);
+  xformed = (double *) alloc_aligned((unsigned) sizeof(double) * 5 *
+                                     lvl->npoints);
+
+  /* (map2bin.c does the same to write binary map data files)
+   */
+  scale = 1.0 / MapDataScale;
+  raw   = map_data;
+  idx   = 0;
+  for (i=0; i<lvl->ncurves; i++)
+  {
+    lvl->curves[i].npts  = raw[0];
+    lvl->curves[i].val   = raw[1];
+    lvl->curves[i].first = idx;
+    raw += 2;
+
+    x = 0;
+    y = 0;
+    z = 0;
+    for (j=0; j<lvl->curves[i].npts; j++)
+    {
+      x += raw[0];
+      y += raw[1];
+      z += raw[2];
+
+      lvl->x[idx] = x * scale;
+      lvl->y[idx] = y * scale;
+      lvl->z[idx] = z * scale;
+
+      raw += 3;
+      idx += 1;
+    }
+
+    bound_curve(lvl, &(lvl->curves[i]));
+  }
+  bound_chunks(lvl);
+}
+
+
+/* compute the bounding cap for a curve, and note how far its
+ * longest segment sags inside the sphere
+ */
+static void bound_curve(lvl, c)
+     MapLevel *lvl;
+     MapCurve *c;
+{
+  int    i, prev;
+  double tmp;
+  double sag;
+
+  bound_cap(lvl, c, 0, c->npts, &(c->cap));
+
+  prev = c->first + c->npts - 1;
+  for (i=c->first; i<c->first+c->npts; i++)
+  {
+    tmp = (lvl->x[prev] * lvl->x[i]) + (lvl->y[prev] * lvl->y[i]) +
+      (lvl->z[prev] * lvl->z[i]);
+    if (tmp > 1) tmp = 1;
+    if (tmp < -1) tmp = -1;
+    sag = 1 - sqrt((1 + tmp) / 2);
+    if (sag > lvl->max_sag) lvl->max_sag = sag;
+    prev = i;
+  }
+}
+
+
+/* compute a cap (center at the normalized mean of the points, radius
+ * out to the farthest one) bounding the n points of curve c starting
+ * with point lo, wrapping around from the last point to the first
+ */
+static void bound_cap(lvl, c, lo, n, cap)
+     MapLevel *lvl;
+     MapCurve *c;
+     int       lo;
+     int       n;
+     MapCap   *cap;
+{
+  float *map_x;
+  float *map_y;
+  float *map_z;
+  int    i, j;
+  double x, y, z;
+  double tmp;
+  double min_dot;
+
+  map_x = lvl->x;
+  map_y = lvl->y;
+  map_z = lvl->z;
+
+  x = 0;
+  y = 0;
+  z = 0;
+  for (j=lo; j<lo+n; j++)
+  {
+    i  = c->first + (j % c->npts);
+    x += map_x[i];
+    y += map_y[i];
+    z += map_z[i];
+  }
+
+  tmp = sqrt((x*x) + (y*y) + (z*z));
+  if (tmp < 1e-6)
+  {
+    /* points are spread all over the sphere; no useful bound
+     */
+    cap->x     = 0;
+    cap->y     = 0;
+    cap->z     = 1;
+    cap->cos_r = -1;
+    cap->sin_r = 0;
+  }
+  else
+  {
+    cap->x = x / tmp;
+    cap->y = y / tmp;
+    cap->z = z / tmp;
+
+    min_dot = 1;
+    for (j=lo; j<lo+n; j++)
+    {
+      i   = c->first + (j % c->npts);
+      tmp = (cap->x * map_x[i]) + (cap->y * map_y[i]) + (cap->z * map_z[i]);
+      if (tmp < min_dot) min_dot = tmp;
+    }
+
+    /* pad the radius a bit to cover rounding in the points
+     */
+    tmp = acos(min_dot) + 1e-4;
+    if (tmp > M_PI) tmp = M_PI;
+    cap->cos_r = cos(tmp);
+    cap->sin_r = sin(tmp);
+  }
+}
+
+
+/* compute the chunk caps for all of the curves in lvl
+ */
+static void bound_chunks(lvl)
+     MapLevel *lvl;
+{
+  int       i, j;
+  int       n, idx;
+  MapCurve *c;
+
+  n = 0;
+  for (i=0; i<lvl->ncurves; i++)
+    n += (lvl->curves[i].npts + CHUNK_POINTS-1) / CHUNK_POINTS;
+
+  lvl->chunks = (MapCap *) malloc((unsigned) sizeof(MapCap) * (n+1));
+  assert(lvl->chunks != NULL);
+
+  idx = 0;
+  for (i=0; i<lvl->ncurves; i++)
+  {
+    c = &(lvl->curves[i]);
+    c->first_chunk = idx;
+    for (j=0; j<c->npts; j+=CHUNK_POINTS)
+    {
+      n = c->npts - j;
+      if (n > CHUNK_POINTS) n = CHUNK_POINTS;
+      bound_cap(lvl, c, j, n+1, &(lvl->chunks[idx]));
+      idx += 1;
+    }
+  }
+}
+
+
+/* build lvl, a copy of src with each curve simplified to within tol
+ */
+static void build_level(lvl, src, tol)
+     MapLevel *lvl;
+     MapLevel *src;
+     double    tol;
+{
+  int       i, j;
+  int       n, idx;
+  int       far;
+  double    dx, dy, dz;
+  double    dist, max_dist;
+  char     *keep;
+  int      *ring;
+  double   *seg;
+  MapCurve *c;
+  MapCurve *dst;
+
+  keep = (char *) malloc((unsigned) src->npoints);
+  assert(keep != NULL);
+  memset(keep, 0, (unsigned) src->npoints);
+  ring = (int *) malloc((unsigned) sizeof(int) * src->npoints);
+  assert(ring != NULL);
+  seg = (double *) malloc((unsigned) sizeof(double) * src->npoints);
+  assert(seg != NULL);
+
+  /* mark the points to keep; the curves are closed, so split each
+   * one in two at its first point and the point farthest from it,
+   * and simplify the halves
+   */
+  lvl->ncurves = 0;
+  lvl->npoints = 0;
+  for (i=0; i<src->ncurves; i++)
+  {
+    c = &(src->curves[i]);
+    if (c->npts <= 3)
+    {
+      memset(keep + c->first, 1, (unsigned) c->npts);
+      n = c->npts;
+    }
+    else
+    {
+      far      = 0;
+      max_dist = 0;
+      for (j=1; j<c->npts; j++)
+      {
+        dx   = src->x[c->first+j] - src->x[c->first];
+        dy   = src->y[c->first+j] - src->y[c->first];
+        dz   = src->z[c->first+j] - src->z[c->first];
+        dist = (dx*dx) + (dy*dy) + (dz*dz);
+        if (dist > max_dist)
+        {
+          far      = j;
+          max_dist = dist;
+        }
+      }
+
+      keep[c->first]     = 1;
+      keep[c->first+far] = 1;
+      simplify_curve(src, c, 0, far, tol, keep);
+      simplify_curve(src, c, far, c->npts, tol, keep);
+
+      n = 0;
+      for (j=0; j<c->npts; j++)
+        n += keep[c->first+j];
+
+      /* a simplified curve that winds the other way around or
+       * crosses itself no longer has the same inside; where it meets
+       * the edge of the globe (or of the map), the edge crossings
+       * then get paired up the wrong way around and flood the whole
+       * globe. such curves are kept at full detail.
+       */
+      if ((n >= 3) && bad_ring(src, c, keep, ring, seg))
+      {
+        memset(keep + c->first, 1, (unsigned) c->npts);
+        n = c->npts;
+      }
+    }
+
+    if (n >= 3)
+    {
+      lvl->ncurves += 1;
+      lvl->npoints += n;
+    }
+  }
+
+  lvl->tol     = tol;
+  lvl->max_sag = 0;
+  lvl->curves  = (MapCurve *) malloc((unsigned) sizeof(MapCurve) *
+                                     lvl->ncurves);
+  assert(lvl->curves != NULL);
+  lvl->x = (float *) alloc_aligned((unsigned) sizeof(float) * lvl->npoints);
+  lvl->y = (float *) alloc_aligned((unsigned) sizeof(float) * lvl->npoints);
+  lvl->z = (float *) alloc_aligned((unsigned) sizeof(float) * lvl->npoints);
+
+  /* copy the kept points of the surviving curves
+   */
+  dst = lvl->curves;
+  idx = 0;
+  for (i=0; i<src->ncurves; i++)
+  {
+    c = &(src->curves[i]);
+
+    n = 0;
+    for (j=0; j<c->npts; j++)
+      n += keep[c->first+j];
+    if (n < 3) continue;
+
+    dst->npts  = n;
+    dst->val   = c->val;
+    dst->first = idx;
+    for (j=c->first; j<c->first+c->npts; j++)
+      if (keep[j])
+      {
+        lvl->x[idx] = src->x[j];
+        lvl->y[idx] = src->y[j];
+        lvl->z[idx] = src->z[j];
+        idx += 1;
+      }
+
+    bound_curve(lvl, dst);
+    dst += 1;
+  }
+  bound_chunks(lvl);
+
+  free(seg);
+  free(ring);
+  free(keep);
+}
+
+
+/* would the ring through the kept points of curve c wind the other
+ * way around, or cross itself? ring[] and seg[] are scratch space
+ * (at least c->npts long) for the indices of the points and the
+ * lengths of the segments starting at them.
+ *
+ * segments AB and CD cross if A and B lie on opposite sides of the
+ * great circle through C and D, and C and D on opposite sides of
+ * the one through A and B; segments too far apart to touch are
+ * ruled out first (which also rules out the case where the great
+ * circles meet on the far side of the sphere).
+ */
+static int bad_ring(src, c, keep, ring, seg)
+     MapLevel *src;
+     MapCurve *c;
+     char     *keep;
+     int      *ring;
+     double   *seg;
+{
+  int    i, j, n;
+  int    a, b, p, q;
+  double dx, dy, dz;
+  double nx, ny, nz;
+  double s1, s2;
+
+  for (i=0; i<c->npts; i++)
+    ring[i] = c->first + i;
+  s1 = ring_area(src, ring, c->npts, &(c->cap));
+
+  n = 0;
+  for (i=c->first; i<c->first+c->npts; i++)
+    if (keep[i])
+      ring[n++] = i;
+  s2 = ring_area(src, ring, n, &(c->cap));
+
+  if (((s1 > 0) && (s2 <= 0)) || ((s1 < 0) && (s2 >= 0)))
+    return 1;
+
+  for (i=0; i<n; i++)
+  {
+    a  = ring[i];
+    b  = ring[(i+1) % n];
+    dx = src->x[b] - src->x[a];
+    dy = src->y[b] - src->y[a];
+    dz = src->z[b] - src->z[a];
+    seg[i] = sqrt((dx*dx) + (dy*dy) + (dz*dz));
+  }
+
+  for (i=0; i<n; i++)
+  {
+    a = ring[i];
+    b = ring[(i+1) % n];
+
+    /* normal of the great circle through a and b
+     */
+    nx = (src->y[a] * src->z[b]) - (src->z[a] * src->y[b]);
+    ny = (src->z[a] * src->x[b]) - (src->x[a] * src->z[b]);
+    nz = (src->x[a] * src->y[b]) - (src->y[a] * src->x[b]);
+
+    /* (segments that share an endpoint don't count)
+     */
+    for (j=i+2; j<n; j++)
+    {
+      if ((i == 0) && (j == n-1))
+        continue;
+
+      p  = ring[j];
+      q  = ring[(j+1) % n];
+      dx = src->x[p] - src->x[a];
+      dy = src->y[p] - src->y[a];
+      dz = src->z[p] - src->z[a];
+      if (sqrt((dx*dx) + (dy*dy) + (dz*dz)) > seg[i] + seg[j])
+        continue;
+
+      s1 = (nx * src->x[p]) + (ny * src->y[p]) + (nz * src->z[p]);
+      s2 = (nx * src->x[q]) + (ny * src->y[q]) + (nz * src->z[q]);
+      if (((s1 > 0) && (s2 > 0)) || ((s1 < 0) && (s2 < 0)))
+        continue;
+
+      dx = (src->y[p] * src->z[q]) - (src->z[p] * src->y[q]);
+      dy = (src->z[p] * src->x[q]) - (src->x[p] * src->z[q]);
+      dz = (src->x[p] * src->y[q]) - (src->y[p] * src->x[q]);
+      s1 = (dx * src->x[a]) + (dy * src->y[a]) + (dz * src->z[a]);
+      s2 = (dx * src->x[b]) + (dy * src->y[b]) + (dz * src->z[b]);
+      if (((s1 > 0) && (s2 > 0)) || ((s1 < 0) && (s2 < 0)))
+        continue;
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/* twice the signed area of the (flat) polygon through the n points
+ * ring[] refers to, as seen looking down on the center of cap;
+ * positive if the points go around counterclockwise
+ */
+static double ring_area(src, ring, n, cap)
+     MapLevel *src;
+     int      *ring;
+     int       n;
+     MapCap   *cap;
+{
+  int    i;
+  int    a, b;
+  double rslt;
+
+  rslt = 0;
+  for (i=0; i<n; i++)
+  {
+    a = ring[i];
+    b = ring[(i+1) % n];
+    rslt += cap->x * ((src->y[a] * src->z[b]) - (src->z[a] * src->y[b]));
+    rslt += cap->y * ((src->z[a] * src->x[b]) - (src->x[a] * src->z[b]));
+    rslt += cap->z * ((src->x[a] * src->y[b]) - (src->y[a] * src->x[b]));
+  }
+
+  return rslt;
+}
+
+
+/* Douglas-Peucker: mark the points of curve c strictly between lo
+ * and hi (point npts being point 0 again) that need to be kept so
+ * that no point is dropped that is more than tol away from the
+ * segment replacing it
+ */
+static void simplify_curve(src, c, lo, hi, tol, keep)
+     MapLevel *src;
+     MapCurve *c;
+     int       lo;
+     int       hi;
+     double    tol;
+     char     *keep;
+{
+  int    i;
+  int    a, b;
+  int    far;
+  double dx, dy, dz;
+  double px, py, pz;
+  double t, len;
+  double dist, max_dist;
+
+  if (hi - lo < 2)
+    return;
+
+  a  = c->first + lo;
+  b  = c->first + ((hi < c->npts) ? hi : 0);
+  dx = src->x[b] - src->x[a];
+  dy = src->y[b] - src->y[a];
+  dz = src->z[b] - src->z[a];
+  len = (dx*dx) + (dy*dy) + (dz*dz);
+
+  far      = -1;
+  max_dist = tol * tol;
+  for (i=lo+1; i<hi; i++)
+  {
+    px = src->x[c->first+i] - src->x[a];
+    py = src->y[c->first+i] - src->y[a];
+    pz = src->z[c->first+i] - src->z[a];
+
+    /* distance to the closest point on the segment
+     */
+    t = (len > 0) ? (((px*dx) + (py*dy) + (pz*dz)) / len) : 0;
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    px -= t * dx;
+    py -= t * dy;
+    pz -= t * dz;
+
+    dist = (px*px) + (py*py) + (pz*pz);
+    if (dist > max_dist)
+    {
+      far      = i;
+      max_dist = dist;
+    }
+  }
+
+  if (far >= 0)
+  {
+    keep[c->first+far] = 1;
+    simplify_curve(src, c, lo, far, tol, keep);
+    simplify_curve(src, c, far, hi, tol, keep);
+  }
+}
+
+
+/* pick the coarsest level of detail that is still within
+ * LOD_MAX_ERROR pixels (building it, if this is the first time it
+ * has been needed) and make it current. in the mercator and
+ * cylindrical projections, distances get stretched away from the
+ * equator (by up to cosh(y) and 1+y*y, respectively, y being the
+ * largest projected latitude on screen), so take that into account.
+ */
+static void select_level()
+{
+  int       i;
+  double    y;
+  double    scale;
+
+  scale = proj_info.proj_scale;
+  if (proj_type != ProjTypeOrthographic)
+  {
+    y = fabs(proj_info.proj_yofs);
+    if (fabs(hght - proj_info.proj_yofs) > y)
+      y = fabs(hght - proj_info.proj_yofs);
+    y *= proj_info.inv_proj_scale;
+
+    if (proj_type == ProjTypeMercator)
+      scale *= cosh(y);
+    else /* (proj_type == ProjTypeCylindrical) */
+      scale *= 1 + (y*y);
+  }
+
+  for (i=LOD_LEVELS-1; i>0; i--)
+    if (LOD_TOLERANCE * (1 << (i-1)) * scale <= LOD_MAX_ERROR)
+      break;
+
+  if (levels[i].curves == NULL)
+    build_level(&(levels[i]), &(levels[0]), LOD_TOLERANCE * (1 << (i-1)));
+
+  use_level(i);
+}
+
+
+/* scan level i of detail in the current pass
+ */
+static void use_level(i)
+     int i;
+{
+  MapLevel *lvl;
+
+  lvl = &(levels[i]);
+  scan_level = i;
+  ncurves = lvl->ncurves;
+  curves  = lvl->curves;
+  npoints = lvl->npoints;
+  map_x   = lvl->x;
+  map_y   = lvl->y;
+  map_z   = lvl->z;
+  max_sag = lvl->max_sag;
+  chunks  = lvl->chunks;
+}
+
+
+/* fold the three rotations done by XFORM_ROTATE into a single matrix
+ * (view_pos_info.xform) by rotating each of the basis vectors
+ */
+static void compute_xform()
+{
+  int    i, j;
+  double tmp[3];
+
+  for (j=0; j<3; j++)
+  {
+    tmp[0] = (j == 0);
+    tmp[1] = (j == 1);
+    tmp[2] = (j == 2);
+    XFORM_ROTATE(tmp, view_pos_info);
+
+    for (i=0; i<3; i++)
+      view_pos_info.xform[i][j] = tmp[i];
+  }
+}
+
+
+/* rotate points lo through hi-1 (using view_pos_info.xform) into
+ * xformed[], stride doubles apart
+ */
+static void xform_points(lo, hi, stride)
+     int lo;
+     int hi;
+     int stride;
+{
+  int     i;
+  double  x, y, z;
+  double  m00, m01, m02;
+  double  m10, m11, m12;
+  double  m20, m21, m22;
+  double *pos;
+
+  /* explicitly copy the matrix to local variables to help
+   * compilers figure out that they can be registered
    */
-  if (first_scan)
-  {
-    scanbits  = extarr_alloc(sizeof(ScanBit));
-    edgexings = extarr_alloc(sizeof(EdgeXing));
-  }
-  else
+  m00 = view_pos_info.xform[0][0];
+  m01 = view_pos_info.xform[0][1];
+  m02 = view_pos_info.xform[0][2];
+  m10 = view_pos_info.xform[1][0];
+  m11 = view_pos_info.xform[1][1];
+  m12 = view_pos_info.xform[1][2];
+  m20 = view_pos_info.xform[2][0];
+  m21 = view_pos_info.xform[2][1];
+  m22 = view_pos_info.xform[2][2];
+
+  pos = xformed + lo*stride;
+  for (i=lo; i<hi; i++)
   {
-    scanbits->count  = 0;
-    edgexings->count = 0;
-  }
+    x = map_x[i];
+    y = map_y[i];
+    z = map_z[i];
 
-  /* maybe only allocate these once and reset them on
-   * subsequent passes (like scanbits and edgexings)?
-   */
-  scanbuf = (ExtArr *) malloc((unsigned) sizeof(ExtArr) * hght);
-  assert(scanbuf != NULL);
-  for (i=0; i<hght; i++)
-    scanbuf[i] = extarr_alloc(sizeof(double));
+    pos[0] = (m00 * x) + (m01 * y) + (m02 * z);
+    pos[1] = (m10 * x) + (m11 * y) + (m12 * z);
+    pos[2] = (m20 * x) + (m21 * y) + (m22 * z);
 
-  if (proj_type == ProjTypeOrthographic)
-  {
-    orth_scan_outline();
-    orth_scan_curves();
+    pos += stride;
   }
-  else if (proj_type == ProjTypeMercator)
+}
+
+
+/* get nworkers scan states ready for a new pass, splitting the curves
+ * into contiguous ranges with roughly equal numbers of points
+ */
+static void setup_states(nworkers)
+     int nworkers;
+{
+  int        i, j;
+  int        cidx;
+  long       total;
+  long       sofar;
+  ScanState *ss;
+
+  if (nworkers > nstates)
   {
-    merc_scan_outline();
-    merc_scan_curves();
+    states = (ScanState *) realloc(states, sizeof(ScanState) * nworkers);
+    assert(states != NULL);
+
+    for (i=nstates; i<nworkers; i++)
+    {
+      states[i].edges     = extarr_alloc(sizeof(ScanEdge));
+      states[i].active    = extarr_alloc(sizeof(int));
+      states[i].edge_row  = NULL;
+      states[i].left_flip = NULL;
+      states[i].nrows     = 0;
+      states[i].scanbits  = extarr_alloc(sizeof(ScanBit));
+      states[i].edgexings = extarr_alloc(sizeof(EdgeXing));
+      states[i].spans     = extarr_alloc(sizeof(ScanSpan));
+      states[i].skip      = extarr_alloc(sizeof(char));
+      states[i].raw_spans = 0;
+    }
+
+    nstates = nworkers;
   }
-  else /* (proj_type == ProjTypeCylindrical) */
+
+  total = npoints;
+
+  cidx  = 0;
+  sofar = 0;
+  for (i=0; i<nworkers; i++)
   {
-    cyl_scan_outline();
-    cyl_scan_curves();
+    ss = &(states[i]);
+    ss->scanbits->count  = 0;
+    ss->edgexings->count = 0;
+    ss->xing_bad         = 0;
+    ss->clip_lo_x        = -CLIP_GUARD;
+    ss->clip_hi_x        = wdth + CLIP_GUARD;
+
+    /* the edge table is reused from pass to pass; it only needs
+     * to be (re)allocated if the image got taller
+     */
+    if (ss->nrows < hght)
+    {
+      ss->edge_row = (int *) realloc(ss->edge_row, sizeof(int) * hght);
+      assert(ss->edge_row != NULL);
+      ss->left_flip = (char *) realloc(ss->left_flip, (unsigned) hght+1);
+      assert(ss->left_flip != NULL);
+      ss->nrows = hght;
+      for (j=0; j<hght; j++)
+        ss->edge_row[j] = -1;
+      memset(ss->left_flip, 0, (unsigned) hght+1);
+    }
+
+    ss->lo_curve = cidx;
+    if (i == nworkers-1)
+    {
+      cidx = ncurves;
+    }
+    else
+    {
+      while ((cidx < ncurves) && (sofar * nworkers < total * (i+1)))
+      {
+        sofar += curves[cidx].npts;
+        cidx  += 1;
+      }
+    }
+    ss->hi_curve = cidx;
   }
+}
+
 
-  for (i=0; i<hght; i++)
-    extarr_free(scanbuf[i]);
-  free(scanbuf);
+/* pool_run() callback; worker idx scans its range of curves
+ */
+void scan_curves(idx, arg)
+     int   idx;
+     void *arg;
+{
+  ScanState *ss;
 
-  qsort(scanbits->body, scanbits->count, sizeof(ScanBit), scanbit_comp);
+  ss = ((ScanState *) arg) + idx;
 
-  first_scan = 0;
+  if (proj_type == ProjTypeOrthographic)
+    orth_scan_curves(ss);
+  else if (proj_type == ProjTypeMercator)
+    merc_scan_curves(ss);
+  else /* (proj_type == ProjTypeCylindrical) */
+    cyl_scan_curves(ss);
 }
 
 
-void orth_scan_outline()
+void orth_scan_outline(ss)
+     ScanState *ss;
 {
-  min_y = hght;
-  max_y = -1;
+  ss->min_y = hght;
+  ss->max_y = -1;
 
-  orth_scan_arc(1.0, 0.0, 0.0, 1.0, 0.0, (2*M_PI));
+  orth_scan_arc(ss, 1.0, 0.0, 0.0, 1.0, 0.0, (2*M_PI));
 
-  get_scanbits(64);
+  get_scanbits(ss, 64);
 }
 
 
-void orth_scan_curves()
+void orth_scan_curves(ss)
+     ScanState *ss;
 {
-  int     i;
-  int     cidx;
-  int     npts;
-  int     val;
-  short  *raw;
-  double *pos;
-  double *prev;
-  double *curr;
-
-  cidx = 0;
-  raw  = map_data;
-  while (1)
+  int       i, k;
+  int       cidx;
+  int       npts;
+  int       nchunks;
+  int       val;
+  int       lo, hi;
+  int       clip;
+  double    x, y;
+  double    tmp;
+  double    sin_a, cos_a;
+  double    m2[3];
+  double    bounds[4];
+  MapCurve *c;
+  char     *skip;
+  double   *pos;
+  double   *prev;
+  double   *curr;
+
+  /* everything that lands on the screen is within angle a of the
+   * view direction (m2[]), where sin(a) is the distance from the
+   * center of the projection to the farthest corner of the screen,
+   * plus a few pixels and the worst-case chord sag for good measure.
+   * a curve can be skipped (without even being rotated) if its
+   * bounding cap is more than a away from the view direction: if
+   * a cap of radius r is centered angle t from it, that is the case
+   * when t > r+a, or cos(t) < cos(r)*cos(a) - sin(r)*sin(a). (this
+   * catches curves entirely on the far side of the globe too, since
+   * a is never more than 90 degrees.)
+   */
+  x = fabs(proj_info.proj_xofs);
+  y = fabs(proj_info.proj_yofs);
+  tmp = fabs(wdth - proj_info.proj_xofs);
+  if (tmp > x) x = tmp;
+  tmp = fabs(hght - proj_info.proj_yofs);
+  if (tmp > y) y = tmp;
+  sin_a = (sqrt((x*x) + (y*y)) + 2) * proj_info.inv_proj_scale + max_sag;
+  if (sin_a > 1) sin_a = 1;
+  cos_a = sqrt(1 - (sin_a*sin_a));
+
+  m2[0] = view_pos_info.xform[2][0];
+  m2[1] = view_pos_info.xform[2][1];
+  m2[2] = view_pos_info.xform[2][2];
+
+  /* if the globe doesn't fit on the screen, the curves that make it
+   * past that test can still be mostly off screen; in that case,
+   * look at their chunks too. bounds[] is the screen (plus a couple
+   * of pixels) in unit (unprojected) coordinates.
+   */
+  clip = ((proj_info.proj_xofs - proj_info.proj_scale < 0) ||
+          (proj_info.proj_xofs + proj_info.proj_scale > wdth) ||
+          (proj_info.proj_yofs - proj_info.proj_scale < 0) ||
+          (proj_info.proj_yofs + proj_info.proj_scale > hght));
+  bounds[0] = INV_XPROJECT(-2);
+  bounds[1] = INV_XPROJECT(wdth+2);
+  bounds[2] = INV_YPROJECT(hght+2);
+  bounds[3] = INV_YPROJECT(-2);
+
+  for (cidx=ss->lo_curve; cidx<ss->hi_curve; cidx++)
   {
-    npts = raw[0];
-    if (npts == 0) break;
-    val  = raw[1];
-    raw += 2;
+    c = &(curves[cidx]);
+    if (c->cap.cos_r > 0)       /* never skip caps of 90+ degrees */
+    {
+      tmp = (m2[0] * c->cap.x) + (m2[1] * c->cap.y) + (m2[2] * c->cap.z);
+      if (tmp < (c->cap.cos_r * cos_a) - (c->cap.sin_r * sin_a))
+        continue;
+    }
 
-    pos   = orth_extract_curve(npts, raw);
-    prev  = pos + (npts-1)*3;
-    curr  = pos;
-    min_y = hght;
-    max_y = -1;
+    npts    = c->npts;
+    val     = c->val;
+    pos     = xformed + c->first*3;
+    nchunks = (npts + CHUNK_POINTS-1) / CHUNK_POINTS;
+
+    /* mark the chunks to skip, and rotate the points of the others.
+     * the first point of a skipped chunk is still needed: the rest
+     * of its points are replaced by a segment from there to the next
+     * chunk. that and the segments it replaces (all entirely in front
+     * of the globe and off the same side of the screen) form a loop
+     * that encloses only pixels off that side of the screen, so this
+     * doesn't change what is on the screen.
+     */
+    ss->skip->count = 0;
+    for (k=0; k<nchunks; k++)
+    {
+      skip  = (char *) extarr_next(ss->skip);
+      *skip = clip && cap_off_screen(&(chunks[c->first_chunk+k]), bounds);
+    }
+    skip = (char *) ss->skip->body;
 
-    for (i=0; i<npts; i++)
+    if (!clip)
     {
-      orth_scan_along_curve(prev, curr, cidx);
-      prev  = curr;
-      curr += 3;
+      orth_extract_points(c->first, c->first + npts);
+    }
+    else
+    {
+      for (k=0; k<nchunks; k++)
+      {
+        lo = c->first + k*CHUNK_POINTS;
+        hi = skip[k] ? lo+1 : lo+CHUNK_POINTS;
+        if (hi > c->first + npts) hi = c->first + npts;
+        orth_extract_points(lo, hi);
+      }
     }
 
-    free(pos);
-    if (edgexings->count > 0)
-      orth_handle_xings();
-    if (min_y <= max_y)
-      get_scanbits(val);
+    if (skip[nchunks-1])
+      prev = pos + (nchunks-1)*CHUNK_POINTS*3;
+    else
+      prev = pos + (npts-1)*3;
+    ss->min_y = hght;
+    ss->max_y = -1;
+
+    for (k=0; k<nchunks; k++)
+    {
+      lo = k*CHUNK_POINTS;
+      hi = skip[k] ? lo+1 : lo+CHUNK_POINTS;
+      if (hi > npts) hi = npts;
+
+      curr = pos + lo*3;
+      for (i=lo; i<hi; i++)
+      {
+        orth_scan_along_curve(ss, prev, curr, cidx);
+        prev  = curr;
+        curr += 3;
+      }
+    }
 
-    cidx += 1;
-    raw  += 3*npts;
+    if (ss->edgexings->count > 0)
+      orth_handle_xings(ss);
+    if (ss->xing_bad)
+    {
+      clear_edges(ss);
+      return;
+    }
+    if (ss->min_y <= ss->max_y)
+      get_scanbits(ss, val);
   }
 }
 
 
-double *orth_extract_curve(npts, data)
-     int    npts;
-     short *data;
+/* is all of cap in front of the globe (in the current view) and
+ * beyond one side of bounds[] (in unit coordinates: left, right,
+ * bottom, top)? if a cap of radius r is centered angle t from an
+ * axis, the points in it are between angles t-r and t+r from the
+ * axis, so their coordinates along it are between cos(t+r) and
+ * cos(t-r) (or 1, if t < r); with v = cos(t), that is
+ * v*cos(r) -/+ sqrt(1-v*v)*sin(r).
+ */
+static int cap_off_screen(cap, bounds)
+     MapCap *cap;
+     double *bounds;
 {
-  int     i;
-  int     x, y, z;
-  double  scale;
-  double *pos;
-  double *rslt;
+  int    i;
+  double v, w;
+  double lo, hi;
+  double tmp[3];
 
-  rslt = (double *) malloc((unsigned) sizeof(double) * 3 * npts);
-  assert(rslt != NULL);
+  if (cap->cos_r <= 0)
+    return 0;
+
+  for (i=0; i<3; i++)
+    tmp[i] = (view_pos_info.xform[i][0] * cap->x) +
+      (view_pos_info.xform[i][1] * cap->y) +
+      (view_pos_info.xform[i][2] * cap->z);
 
-  x     = 0;
-  y     = 0;
-  z     = 0;
-  scale = 1.0 / MAP_DATA_SCALE;
-  pos   = rslt;
+  /* in front of the globe: t+r < 90 degrees
+   */
+  if (tmp[2] <= cap->sin_r)
+    return 0;
 
-  for (i=0; i<npts; i++)
+  for (i=0; i<2; i++)
   {
-    x += data[0];
-    y += data[1];
-    z += data[2];
+    v  = tmp[i];
+    w  = sqrt(1 - (v*v)) * cap->sin_r;
+    lo = (v < -cap->cos_r) ? -1 : (v * cap->cos_r) - w;
+    hi = (v > cap->cos_r) ? 1 : (v * cap->cos_r) + w;
+
+    if ((lo > bounds[2*i+1]) || (hi < bounds[2*i]))
+      return 1;
+  }
 
-    pos[0] = x * scale;
-    pos[1] = y * scale;
-    pos[2] = z * scale;
+  return 0;
+}
 
-    XFORM_ROTATE(pos, view_pos_info);
 
-    data += 3;
-    pos  += 3;
+/* the longitude half of bounds[] for merc_scan_curves() and
+ * cyl_scan_curves(); returns whether it is worth looking for curves
+ * and chunks to skip at all (only if the map is wider than the
+ * screen). when scanning spans for shifting in longitude later (see
+ * scan_lon_spans()), the whole width of the map is needed.
+ */
+static int lon_bounds(ss, bounds)
+     ScanState *ss;
+     double    *bounds;
+{
+  if (ss->raw_spans)
+  {
+    bounds[0] = -2*M_PI;
+    bounds[1] = 2*M_PI;
+  }
+  else
+  {
+    bounds[0] = INV_XPROJECT(-2);
+    bounds[1] = INV_XPROJECT(wdth+2);
   }
 
-  return rslt;
+  return ((XPROJECT(-M_PI) < 0) || (XPROJECT(M_PI) > wdth));
 }
 
 
-void orth_scan_along_curve(prev, curr, cidx)
-     double *prev;
-     double *curr;
-     int     cidx;
+/* is all of cap beyond one side of bounds[] (longitude and latitude,
+ * in radians: left, right, bottom, top) in the current view, without
+ * reaching a pole or the +/-180 degree seam? curves are scanned as
+ * straight lines between projected points, so if their points are
+ * within a range of longitude and latitude, so is everything scanned
+ * for them; and without crossing the seam, that adds no edge
+ * crossings. if a cap of radius r is centered at latitude t, its
+ * points are between latitudes t-r and t+r, and (if that doesn't take
+ * in a pole) within asin(sin(r)/cos(t)) of its center's longitude.
+ */
+static int lon_cap_off_screen(cap, bounds)
+     MapCap *cap;
+     double *bounds;
+{
+  int    i;
+  double r, d;
+  double lat, lon;
+  double tmp[3];
+
+  if (cap->cos_r <= 0)
+    return 0;
+
+  for (i=0; i<3; i++)
+    tmp[i] = (view_pos_info.xform[i][0] * cap->x) +
+      (view_pos_info.xform[i][1] * cap->y) +
+      (view_pos_info.xform[i][2] * cap->z);
+
+  if (tmp[1] > 1) tmp[1] = 1;
+  if (tmp[1] < -1) tmp[1] = -1;
+  lat = asin(tmp[1]);
+  r   = atan2(cap->sin_r, cap->cos_r);
+  if (fabs(lat) + r >= (M_PI/2))
+    return 0;
+
+  lon = atan2(tmp[0], tmp[2]);
+  d   = asin(cap->sin_r / cos(lat));
+  if ((lon - d <= -M_PI) || (lon + d >= M_PI))
+    return 0;
+
+  return ((lat - r > bounds[3]) || (lat + r < bounds[2]) ||
+          (lon - d > bounds[1]) || (lon + d < bounds[0]));
+}
+
+
+/* mark the chunks of c to skip (see lon_cap_off_screen()) in
+ * ss->skip, and return them
+ */
+static char *lon_skip_chunks(ss, c, clip, bounds)
+     ScanState *ss;
+     MapCurve  *c;
+     int        clip;
+     double    *bounds;
+{
+  int   k;
+  int   nchunks;
+  char *skip;
+
+  nchunks = (c->npts + CHUNK_POINTS-1) / CHUNK_POINTS;
+  ss->skip->count = 0;
+  for (k=0; k<nchunks; k++)
+  {
+    skip  = (char *) extarr_next(ss->skip);
+    *skip = clip && lon_cap_off_screen(&(chunks[c->first_chunk+k]), bounds);
+  }
+
+  return (char *) ss->skip->body;
+}
+
+
+void orth_extract_points(lo, hi)
+     int lo;
+     int hi;
+{
+  xform_points(lo, hi, 3);
+}
+
+
+void orth_scan_along_curve(ss, prev, curr, cidx)
+     ScanState *ss;
+     double    *prev;
+     double    *curr;
+     int        cidx;
 {
   double    extra[3];
   EdgeXing *xing;
@@ -450,7 +1930,7 @@ void orth_scan_along_curve(prev, curr, cidx)
     orth_find_edge_xing(prev, curr, extra);
 
     /* extra[] is an edge crossing (entry point) */
-    xing = (EdgeXing *) extarr_next(edgexings);
+    xing = (EdgeXing *) extarr_next(ss->edgexings);
     xing->type  = XingTypeEntry;
     xing->cidx  = cidx;
     xing->x     = extra[0];
@@ -464,7 +1944,7 @@ void orth_scan_along_curve(prev, curr, cidx)
     orth_find_edge_xing(prev, curr, extra);
 
     /* extra[] is an edge crossing (exit point) */
-    xing = (EdgeXing *) extarr_next(edgexings);
+    xing = (EdgeXing *) extarr_next(ss->edgexings);
     xing->type  = XingTypeExit;
     xing->cidx  = cidx;
     xing->x     = extra[0];
@@ -474,7 +1954,7 @@ void orth_scan_along_curve(prev, curr, cidx)
     curr = extra;
   }
 
-  scan(XPROJECT(prev[0]), YPROJECT(prev[1]),
+  scan(ss, XPROJECT(prev[0]), YPROJECT(prev[1]),
        XPROJECT(curr[0]), YPROJECT(curr[1]));
 }
 
@@ -498,7 +1978,8 @@ void orth_find_edge_xing(prev, curr, rslt)
 }
 
 
-void orth_handle_xings()
+void orth_handle_xings(ss)
+     ScanState *ss;
 {
   int       i;
   int       nxings;
@@ -506,8 +1987,8 @@ void orth_handle_xings()
   EdgeXing *from;
   EdgeXing *to;
 
-  xings  = (EdgeXing *) edgexings->body;
-  nxings = edgexings->count;
+  xings  = (EdgeXing *) ss->edgexings->body;
+  nxings = ss->edgexings->count;
 
   assert((nxings % 2) == 0);
   qsort(xings, (unsigned) nxings, sizeof(EdgeXing), orth_edgexing_comp);
@@ -521,9 +2002,12 @@ void orth_handle_xings()
 
       if ((from->type != XingTypeExit) ||
           (to->type != XingTypeEntry))
-        xing_error(__FILE__, __LINE__, i, nxings, xings);
+      {
+        xing_error(ss, __FILE__, __LINE__, i, nxings, xings);
+        return;
+      }
 
-      orth_scan_arc(from->x, from->y, from->angle,
+      orth_scan_arc(ss, from->x, from->y, from->angle,
                     to->x, to->y, to->angle);
     }
   }
@@ -535,9 +2019,12 @@ void orth_handle_xings()
     if ((from->type != XingTypeExit) ||
         (to->type != XingTypeEntry) ||
         (from->angle < to->angle))
-      xing_error(__FILE__, __LINE__, nxings-1, nxings, xings);
+    {
+      xing_error(ss, __FILE__, __LINE__, nxings-1, nxings, xings);
+      return;
+    }
 
-    orth_scan_arc(from->x, from->y, from->angle,
+    orth_scan_arc(ss, from->x, from->y, from->angle,
                   to->x, to->y, to->angle+(2*M_PI));
 
     for (i=1; i<(nxings-1); i+=2)
@@ -547,20 +2034,24 @@ void orth_handle_xings()
 
       if ((from->type != XingTypeExit) ||
           (to->type != XingTypeEntry))
-        xing_error(__FILE__, __LINE__, i, nxings, xings);
+      {
+        xing_error(ss, __FILE__, __LINE__, i, nxings, xings);
+        return;
+      }
 
-      orth_scan_arc(from->x, from->y, from->angle,
+      orth_scan_arc(ss, from->x, from->y, from->angle,
                     to->x, to->y, to->angle);
     }
   }
 
-  edgexings->count = 0;
+  ss->edgexings->count = 0;
 }
 
 
-void orth_scan_arc(x_0, y_0, a_0, x_1, y_1, a_1)
-     double x_0, y_0, a_0;
-     double x_1, y_1, a_1;
+void orth_scan_arc(ss, x_0, y_0, a_0, x_1, y_1, a_1)
+     ScanState *ss;
+     double     x_0, y_0, a_0;
+     double     x_1, y_1, a_1;
 {
   int    i;
   int    lo, hi;
@@ -594,7 +2085,7 @@ void orth_scan_arc(x_0, y_0, a_0, x_1, y_1, a_1)
     {
       curr_x = XPROJECT(arc_x);
       curr_y = YPROJECT(arc_y);
-      scan(prev_x, prev_y, curr_x, curr_y);
+      scan(ss, prev_x, prev_y, curr_x, curr_y);
 
       /* instead of repeatedly calling cos() and sin() to get the next
        * values for arc_x and arc_y, simply rotate the existing values
@@ -610,125 +2101,160 @@ void orth_scan_arc(x_0, y_0, a_0, x_1, y_1, a_1)
 
   curr_x = XPROJECT(x_1);
   curr_y = YPROJECT(y_1);
-  scan(prev_x, prev_y, curr_x, curr_y);
+  scan(ss, prev_x, prev_y, curr_x, curr_y);
 }
 
 
-void merc_scan_outline()
+void merc_scan_outline(ss)
+     ScanState *ss;
 {
   double left, right;
   double top, bottom;
 
-  min_y = hght;
-  max_y = -1;
+  ss->min_y = hght;
+  ss->max_y = -1;
 
   left   = XPROJECT(-M_PI);
   right  = XPROJECT(M_PI);
   top    = YPROJECT(BigNumber);
   bottom = YPROJECT(-BigNumber);
 
-  scan(right, top, left, top);
-  scan(left, top, left, bottom);
-  scan(left, bottom, right, bottom);
-  scan(right, bottom, right, top);
+  scan(ss, right, top, left, top);
+  scan(ss, left, top, left, bottom);
+  scan(ss, left, bottom, right, bottom);
+  scan(ss, right, bottom, right, top);
 
-  get_scanbits(64);
+  get_scanbits(ss, 64);
 }
 
 
-void merc_scan_curves()
+void merc_scan_curves(ss)
+     ScanState *ss;
 {
-  int     i;
-  int     cidx;
-  int     npts;
-  int     val;
-  short  *raw;
-  double *pos;
-  double *prev;
-  double *curr;
+  int       i, k;
+  int       cidx;
+  int       npts;
+  int       nchunks;
+  int       val;
+  int       lo, hi;
+  int       clip;
+  double    tmp;
+  double    bounds[4];
+  MapCurve *c;
+  char     *skip;
+  double   *pos;
+  double   *prev;
+  double   *curr;
+
+  if (ss->lo_curve == ss->hi_curve)
+    return;
+
+  /* if the map is wider than the screen, skip curves and chunks
+   * that are entirely off screen (see lon_cap_off_screen()); bounds[]
+   * is the screen (plus a couple of pixels) in longitude and
+   * latitude. otherwise, just rotate (and project) all of the points
+   * in this worker's range of curves at once.
+   */
+  clip = lon_bounds(ss, bounds);
+  tmp  = INV_YPROJECT(hght+2);
+  bounds[2] = asin(INV_MERCATOR_Y(tmp));
+  tmp  = INV_YPROJECT(-2);
+  bounds[3] = asin(INV_MERCATOR_Y(tmp));
 
-  cidx = 0;
-  raw  = map_data;
-  while (1)
+  if (!clip)
   {
-    npts = raw[0];
-    if (npts == 0) break;
-    val  = raw[1];
-    raw += 2;
+    cidx = ss->hi_curve - 1;
+    merc_extract_points(curves[ss->lo_curve].first,
+                        curves[cidx].first + curves[cidx].npts);
+  }
+
+  for (cidx=ss->lo_curve; cidx<ss->hi_curve; cidx++)
+  {
+    c = &(curves[cidx]);
+    if (clip && lon_cap_off_screen(&(c->cap), bounds))
+      continue;
 
-    pos   = merc_extract_curve(npts, raw);
-    prev  = pos + (npts-1)*5;
-    curr  = pos;
-    min_y = hght;
-    max_y = -1;
+    npts    = c->npts;
+    val     = c->val;
+    pos     = xformed + c->first*5;
+    nchunks = (npts + CHUNK_POINTS-1) / CHUNK_POINTS;
 
-    for (i=0; i<npts; i++)
+    /* as in orth_scan_curves(), the first point of a skipped chunk
+     * is still needed, and joined straight to the next chunk
+     */
+    skip = lon_skip_chunks(ss, c, clip, bounds);
+    if (clip)
     {
-      merc_scan_along_curve(prev, curr, cidx);
-      prev  = curr;
-      curr += 5;
+      for (k=0; k<nchunks; k++)
+      {
+        lo = c->first + k*CHUNK_POINTS;
+        hi = skip[k] ? lo+1 : lo+CHUNK_POINTS;
+        if (hi > c->first + npts) hi = c->first + npts;
+        merc_extract_points(lo, hi);
+      }
     }
 
-    free(pos);
-    if (edgexings->count > 0)
-      merc_handle_xings();
-    if (min_y <= max_y)
-      get_scanbits(val);
+    if (skip[nchunks-1])
+      prev = pos + (nchunks-1)*CHUNK_POINTS*5;
+    else
+      prev = pos + (npts-1)*5;
+    ss->min_y = hght;
+    ss->max_y = -1;
+
+    for (k=0; k<nchunks; k++)
+    {
+      lo = k*CHUNK_POINTS;
+      hi = skip[k] ? lo+1 : lo+CHUNK_POINTS;
+      if (hi > npts) hi = npts;
+
+      curr = pos + lo*5;
+      for (i=lo; i<hi; i++)
+      {
+        merc_scan_along_curve(ss, prev, curr, cidx);
+        prev  = curr;
+        curr += 5;
+      }
+    }
 
-    cidx += 1;
-    raw  += 3*npts;
+    if (ss->edgexings->count > 0)
+      merc_handle_xings(ss);
+    if (ss->xing_bad)
+    {
+      clear_edges(ss);
+      return;
+    }
+    if (ss->min_y <= ss->max_y)
+      get_scanbits(ss, val);
   }
 }
 
 
-double *merc_extract_curve(npts, data)
-     int    npts;
-     short *data;
+void merc_extract_points(lo, hi)
+     int lo;
+     int hi;
 {
   int     i;
-  int     x, y, z;
-  double  scale;
   double *pos;
-  double *rslt;
-
-  rslt = (double *) malloc((unsigned) sizeof(double) * 5 * npts);
-  assert(rslt != NULL);
 
-  x     = 0;
-  y     = 0;
-  z     = 0;
-  scale = 1.0 / MAP_DATA_SCALE;
-  pos   = rslt;
+  xform_points(lo, hi, 5);
 
-  for (i=0; i<npts; i++)
+  /* apply mercator projection
+   */
+  pos = xformed + lo*5;
+  for (i=lo; i<hi; i++)
   {
-    x += data[0];
-    y += data[1];
-    z += data[2];
-
-    pos[0] = x * scale;
-    pos[1] = y * scale;
-    pos[2] = z * scale;
-
-    XFORM_ROTATE(pos, view_pos_info);
-
-    /* apply mercator projection
-     */
     pos[3] = MERCATOR_X(pos[0], pos[2]);
     pos[4] = MERCATOR_Y(pos[1]);
-
-    data += 3;
-    pos  += 5;
+    pos   += 5;
   }
-
-  return rslt;
 }
 
 
-void merc_scan_along_curve(prev, curr, cidx)
-     double *prev;
-     double *curr;
-     int     cidx;
+void merc_scan_along_curve(ss, prev, curr, cidx)
+     ScanState *ss;
+     double    *prev;
+     double    *curr;
+     int        cidx;
 {
   double    px, py;
   double    cx, cy;
@@ -757,10 +2283,10 @@ void merc_scan_along_curve(prev, curr, cidx)
       my = merc_find_edge_xing(prev, curr);
 
       /* scan from prev to exit point */
-      scan(XPROJECT(px), YPROJECT(py), XPROJECT(mx), YPROJECT(my));
+      scan(ss, XPROJECT(px), YPROJECT(py), XPROJECT(mx), YPROJECT(my));
 
       /* (mx, my) is an edge crossing (exit point) */
-      xing = (EdgeXing *) extarr_next(edgexings);
+      xing = (EdgeXing *) extarr_next(ss->edgexings);
       xing->type  = XingTypeExit;
       xing->cidx  = cidx;
       xing->x     = mx;
@@ -769,10 +2295,10 @@ void merc_scan_along_curve(prev, curr, cidx)
 
       /* scan from entry point (right edge) to curr */
       mx = M_PI;
-      scan(XPROJECT(mx), YPROJECT(my), XPROJECT(cx), YPROJECT(cy));
+      scan(ss, XPROJECT(mx), YPROJECT(my), XPROJECT(cx), YPROJECT(cy));
 
       /* (mx, my) is an edge crossing (entry point) */
-      xing = (EdgeXing *) extarr_next(edgexings);
+      xing = (EdgeXing *) extarr_next(ss->edgexings);
       xing->type  = XingTypeEntry;
       xing->cidx  = cidx;
       xing->x     = mx;
@@ -783,7 +2309,7 @@ void merc_scan_along_curve(prev, curr, cidx)
     {
       /* no vertical edge crossing
        */
-      scan(XPROJECT(px), YPROJECT(py), XPROJECT(cx), YPROJECT(cy));
+      scan(ss, XPROJECT(px), YPROJECT(py), XPROJECT(cx), YPROJECT(cy));
     }
   }
   else
@@ -802,10 +2328,10 @@ void merc_scan_along_curve(prev, curr, cidx)
       my = merc_find_edge_xing(prev, curr);
 
       /* scan from prev to exit point */
-      scan(XPROJECT(px), YPROJECT(py), XPROJECT(mx), YPROJECT(my));
+      scan(ss, XPROJECT(px), YPROJECT(py), XPROJECT(mx), YPROJECT(my));
 
       /* (mx, my) is an edge crossing (exit point) */
-      xing = (EdgeXing *) extarr_next(edgexings);
+      xing = (EdgeXing *) extarr_next(ss->edgexings);
       xing->type  = XingTypeExit;
       xing->cidx  = cidx;
       xing->x     = mx;
@@ -814,10 +2340,10 @@ void merc_scan_along_curve(prev, curr, cidx)
 
       /* scan from entry point (left edge) to curr */
       mx = - M_PI;
-      scan(XPROJECT(mx), YPROJECT(my), XPROJECT(cx), YPROJECT(cy));
+      scan(ss, XPROJECT(mx), YPROJECT(my), XPROJECT(cx), YPROJECT(cy));
 
       /* (mx, my) is an edge crossing (entry point) */
-      xing = (EdgeXing *) extarr_next(edgexings);
+      xing = (EdgeXing *) extarr_next(ss->edgexings);
       xing->type  = XingTypeEntry;
       xing->cidx  = cidx;
       xing->x     = mx;
@@ -828,7 +2354,7 @@ void merc_scan_along_curve(prev, curr, cidx)
     {
       /* no vertical edge crossing
        */
-      scan(XPROJECT(px), YPROJECT(py), XPROJECT(cx), YPROJECT(cy));
+      scan(ss, XPROJECT(px), YPROJECT(py), XPROJECT(cx), YPROJECT(cy));
     }
   }
 }
@@ -864,7 +2390,8 @@ double merc_find_edge_xing(prev, curr)
 }
 
 
-void merc_handle_xings()
+void merc_handle_xings(ss)
+     ScanState *ss;
 {
   int       i;
   int       nxings;
@@ -872,8 +2399,8 @@ void merc_handle_xings()
   EdgeXing *from;
   EdgeXing *to;
 
-  xings  = (EdgeXing *) edgexings->body;
-  nxings = edgexings->count;
+  xings  = (EdgeXing *) ss->edgexings->body;
+  nxings = ss->edgexings->count;
 
   assert((nxings % 2) == 0);
   qsort(xings, (unsigned) nxings, sizeof(EdgeXing), merc_edgexing_comp);
@@ -887,9 +2414,12 @@ void merc_handle_xings()
 
       if ((from->type != XingTypeExit) ||
           (to->type != XingTypeEntry))
-        xing_error(__FILE__, __LINE__, i, nxings, xings);
+      {
+        xing_error(ss, __FILE__, __LINE__, i, nxings, xings);
+        return;
+      }
 
-      merc_scan_edge(from, to);
+      merc_scan_edge(ss, from, to);
     }
   }
   else
@@ -900,9 +2430,12 @@ void merc_handle_xings()
     if ((from->type != XingTypeExit) ||
         (to->type != XingTypeEntry) ||
         (from->angle < to->angle))
-      xing_error(__FILE__, __LINE__, nxings-1, nxings, xings);
+    {
+      xing_error(ss, __FILE__, __LINE__, nxings-1, nxings, xings);
+      return;
+    }
 
-    merc_scan_edge(from, to);
+    merc_scan_edge(ss, from, to);
 
     for (i=1; i<(nxings-1); i+=2)
     {
@@ -911,19 +2444,23 @@ void merc_handle_xings()
 
       if ((from->type != XingTypeExit) ||
           (to->type != XingTypeEntry))
-        xing_error(__FILE__, __LINE__, i, nxings, xings);
+      {
+        xing_error(ss, __FILE__, __LINE__, i, nxings, xings);
+        return;
+      }
 
-      merc_scan_edge(from, to);
+      merc_scan_edge(ss, from, to);
     }
   }
 
-  edgexings->count = 0;
+  ss->edgexings->count = 0;
 }
 
 
-void merc_scan_edge(from, to)
-     EdgeXing *from;
-     EdgeXing *to;
+void merc_scan_edge(ss, from, to)
+     ScanState *ss;
+     EdgeXing  *from;
+     EdgeXing  *to;
 {
   int    s0, s1, s_new;
   double x_0, x_1, x_new;
@@ -973,131 +2510,166 @@ void merc_scan_edge(from, to)
       assert(0);
     }
 
-    scan(x_0, y_0, x_new, y_new);
+    scan(ss, x_0, y_0, x_new, y_new);
     x_0 = x_new;
     y_0 = y_new;
     s0 = s_new;
   }
 
-  scan(x_0, y_0, x_1, y_1);
+  scan(ss, x_0, y_0, x_1, y_1);
 }
 
 
-void cyl_scan_outline()
+void cyl_scan_outline(ss)
+     ScanState *ss;
 {
   double left, right;
   double top, bottom;
 
-  min_y = hght;
-  max_y = -1;
+  ss->min_y = hght;
+  ss->max_y = -1;
 
   left   = XPROJECT(-M_PI);
   right  = XPROJECT(M_PI);
   top    = YPROJECT(BigNumber);
   bottom = YPROJECT(-BigNumber);
 
-  scan(right, top, left, top);
-  scan(left, top, left, bottom);
-  scan(left, bottom, right, bottom);
-  scan(right, bottom, right, top);
+  scan(ss, right, top, left, top);
+  scan(ss, left, top, left, bottom);
+  scan(ss, left, bottom, right, bottom);
+  scan(ss, right, bottom, right, top);
 
-  get_scanbits(64);
+  get_scanbits(ss, 64);
 }
 
 
-void cyl_scan_curves()
+void cyl_scan_curves(ss)
+     ScanState *ss;
 {
-  int     i;
-  int     cidx;
-  int     npts;
-  int     val;
-  short  *raw;
-  double *pos;
-  double *prev;
-  double *curr;
+  int       i, k;
+  int       cidx;
+  int       npts;
+  int       nchunks;
+  int       val;
+  int       lo, hi;
+  int       clip;
+  double    tmp;
+  double    bounds[4];
+  MapCurve *c;
+  char     *skip;
+  double   *pos;
+  double   *prev;
+  double   *curr;
+
+  if (ss->lo_curve == ss->hi_curve)
+    return;
+
+  /* if the map is wider than the screen, skip curves and chunks
+   * that are entirely off screen (see lon_cap_off_screen()); bounds[]
+   * is the screen (plus a couple of pixels) in longitude and
+   * latitude. otherwise, just rotate (and project) all of the points
+   * in this worker's range of curves at once.
+   */
+  clip = lon_bounds(ss, bounds);
+  tmp  = INV_YPROJECT(hght+2);
+  bounds[2] = asin(INV_CYLINDRICAL_Y(tmp));
+  tmp  = INV_YPROJECT(-2);
+  bounds[3] = asin(INV_CYLINDRICAL_Y(tmp));
 
-  cidx = 0;
-  raw  = map_data;
-  while (1)
+  if (!clip)
   {
-    npts = raw[0];
-    if (npts == 0) break;
-    val  = raw[1];
-    raw += 2;
+    cidx = ss->hi_curve - 1;
+    cyl_extract_points(curves[ss->lo_curve].first,
+                       curves[cidx].first + curves[cidx].npts);
+  }
 
-    pos   = cyl_extract_curve(npts, raw);
-    prev  = pos + (npts-1)*5;
-    curr  = pos;
-    min_y = hght;
-    max_y = -1;
+  for (cidx=ss->lo_curve; cidx<ss->hi_curve; cidx++)
+  {
+    c = &(curves[cidx]);
+    if (clip && lon_cap_off_screen(&(c->cap), bounds))
+      continue;
+
+    npts    = c->npts;
+    val     = c->val;
+    pos     = xformed + c->first*5;
+    nchunks = (npts + CHUNK_POINTS-1) / CHUNK_POINTS;
 
-    for (i=0; i<npts; i++)
+    /* as in orth_scan_curves(), the first point of a skipped chunk
+     * is still needed, and joined straight to the next chunk
+     */
+    skip = lon_skip_chunks(ss, c, clip, bounds);
+    if (clip)
     {
-      cyl_scan_along_curve(prev, curr, cidx);
-      prev  = curr;
-      curr += 5;
+      for (k=0; k<nchunks; k++)
+      {
+        lo = c->first + k*CHUNK_POINTS;
+        hi = skip[k] ? lo+1 : lo+CHUNK_POINTS;
+        if (hi > c->first + npts) hi = c->first + npts;
+        cyl_extract_points(lo, hi);
+      }
     }
 
-    free(pos);
-    if (edgexings->count > 0)
-      cyl_handle_xings();
-    if (min_y <= max_y)
-      get_scanbits(val);
+    if (skip[nchunks-1])
+      prev = pos + (nchunks-1)*CHUNK_POINTS*5;
+    else
+      prev = pos + (npts-1)*5;
+    ss->min_y = hght;
+    ss->max_y = -1;
+
+    for (k=0; k<nchunks; k++)
+    {
+      lo = k*CHUNK_POINTS;
+      hi = skip[k] ? lo+1 : lo+CHUNK_POINTS;
+      if (hi > npts) hi = npts;
+
+      curr = pos + lo*5;
+      for (i=lo; i<hi; i++)
+      {
+        cyl_scan_along_curve(ss, prev, curr, cidx);
+        prev  = curr;
+        curr += 5;
+      }
+    }
 
-    cidx += 1;
-    raw  += 3*npts;
+    if (ss->edgexings->count > 0)
+      cyl_handle_xings(ss);
+    if (ss->xing_bad)
+    {
+      clear_edges(ss);
+      return;
+    }
+    if (ss->min_y <= ss->max_y)
+      get_scanbits(ss, val);
   }
 }
 
 
-double *cyl_extract_curve(npts, data)
-     int    npts;
-     short *data;
+void cyl_extract_points(lo, hi)
+     int lo;
+     int hi;
 {
   int     i;
-  int     x, y, z;
-  double  scale;
   double *pos;
-  double *rslt;
-
-  rslt = (double *) malloc((unsigned) sizeof(double) * 5 * npts);
-  assert(rslt != NULL);
 
-  x     = 0;
-  y     = 0;
-  z     = 0;
-  scale = 1.0 / MAP_DATA_SCALE;
-  pos   = rslt;
+  xform_points(lo, hi, 5);
 
-  for (i=0; i<npts; i++)
+  /* apply cylindrical projection
+   */
+  pos = xformed + lo*5;
+  for (i=lo; i<hi; i++)
   {
-    x += data[0];
-    y += data[1];
-    z += data[2];
-
-    pos[0] = x * scale;
-    pos[1] = y * scale;
-    pos[2] = z * scale;
-
-    XFORM_ROTATE(pos, view_pos_info);
-
-    /* apply cylindrical projection
-     */
     pos[3] = CYLINDRICAL_X(pos[0], pos[2]);
     pos[4] = CYLINDRICAL_Y(pos[1]);
-
-    data += 3;
-    pos  += 5;
+    pos   += 5;
   }
-
-  return rslt;
 }
 
 
-void cyl_scan_along_curve(prev, curr, cidx)
-     double *prev;
-     double *curr;
-     int     cidx;
+void cyl_scan_along_curve(ss, prev, curr, cidx)
+     ScanState *ss;
+     double    *prev;
+     double    *curr;
+     int        cidx;
 {
   double    px, py;
   double    cx, cy;
@@ -1126,10 +2698,10 @@ void cyl_scan_along_curve(prev, curr, cidx)
       my = cyl_find_edge_xing(prev, curr);
 
       /* scan from prev to exit point */
-      scan(XPROJECT(px), YPROJECT(py), XPROJECT(mx), YPROJECT(my));
+      scan(ss, XPROJECT(px), YPROJECT(py), XPROJECT(mx), YPROJECT(my));
 
       /* (mx, my) is an edge crossing (exit point) */
-      xing = (EdgeXing *) extarr_next(edgexings);
+      xing = (EdgeXing *) extarr_next(ss->edgexings);
       xing->type  = XingTypeExit;
       xing->cidx  = cidx;
       xing->x     = mx;
@@ -1138,10 +2710,10 @@ void cyl_scan_along_curve(prev, curr, cidx)
 
       /* scan from entry point (right edge) to curr */
       mx = M_PI;
-      scan(XPROJECT(mx), YPROJECT(my), XPROJECT(cx), YPROJECT(cy));
+      scan(ss, XPROJECT(mx), YPROJECT(my), XPROJECT(cx), YPROJECT(cy));
 
       /* (mx, my) is an edge crossing (entry point) */
-      xing = (EdgeXing *) extarr_next(edgexings);
+      xing = (EdgeXing *) extarr_next(ss->edgexings);
       xing->type  = XingTypeEntry;
       xing->cidx  = cidx;
       xing->x     = mx;
@@ -1152,7 +2724,7 @@ void cyl_scan_along_curve(prev, curr, cidx)
     {
       /* no vertical edge crossing
        */
-      scan(XPROJECT(px), YPROJECT(py), XPROJECT(cx), YPROJECT(cy));
+      scan(ss, XPROJECT(px), YPROJECT(py), XPROJECT(cx), YPROJECT(cy));
     }
   }
   else
@@ -1171,10 +2743,10 @@ void cyl_scan_along_curve(prev, curr, cidx)
       my = cyl_find_edge_xing(prev, curr);
 
       /* scan from prev to exit point */
-      scan(XPROJECT(px), YPROJECT(py), XPROJECT(mx), YPROJECT(my));
+      scan(ss, XPROJECT(px), YPROJECT(py), XPROJECT(mx), YPROJECT(my));
 
       /* (mx, my) is an edge crossing (exit point) */
-      xing = (EdgeXing *) extarr_next(edgexings);
+      xing = (EdgeXing *) extarr_next(ss->edgexings);
       xing->type  = XingTypeExit;
       xing->cidx  = cidx;
       xing->x     = mx;
@@ -1183,10 +2755,10 @@ void cyl_scan_along_curve(prev, curr, cidx)
 
       /* scan from entry point (left edge) to curr */
       mx = - M_PI;
-      scan(XPROJECT(mx), YPROJECT(my), XPROJECT(cx), YPROJECT(cy));
+      scan(ss, XPROJECT(mx), YPROJECT(my), XPROJECT(cx), YPROJECT(cy));
 
       /* (mx, my) is an edge crossing (entry point) */
-      xing = (EdgeXing *) extarr_next(edgexings);
+      xing = (EdgeXing *) extarr_next(ss->edgexings);
       xing->type  = XingTypeEntry;
       xing->cidx  = cidx;
       xing->x     = mx;
@@ -1197,7 +2769,7 @@ void cyl_scan_along_curve(prev, curr, cidx)
     {
       /* no vertical edge crossing
        */
-      scan(XPROJECT(px), YPROJECT(py), XPROJECT(cx), YPROJECT(cy));
+      scan(ss, XPROJECT(px), YPROJECT(py), XPROJECT(cx), YPROJECT(cy));
     }
   }
 }
@@ -1233,7 +2805,8 @@ double cyl_find_edge_xing(prev, curr)
 }
 
 
-void cyl_handle_xings()
+void cyl_handle_xings(ss)
+     ScanState *ss;
 {
   int       i;
   int       nxings;
@@ -1241,8 +2814,8 @@ void cyl_handle_xings()
   EdgeXing *from;
   EdgeXing *to;
 
-  xings  = (EdgeXing *) edgexings->body;
-  nxings = edgexings->count;
+  xings  = (EdgeXing *) ss->edgexings->body;
+  nxings = ss->edgexings->count;
 
   assert((nxings % 2) == 0);
   qsort(xings, (unsigned) nxings, sizeof(EdgeXing), cyl_edgexing_comp);
@@ -1256,9 +2829,12 @@ void cyl_handle_xings()
 
       if ((from->type != XingTypeExit) ||
           (to->type != XingTypeEntry))
-        xing_error(__FILE__, __LINE__, i, nxings, xings);
+      {
+        xing_error(ss, __FILE__, __LINE__, i, nxings, xings);
+        return;
+      }
 
-      cyl_scan_edge(from, to);
+      cyl_scan_edge(ss, from, to);
     }
   }
   else
@@ -1269,9 +2845,12 @@ void cyl_handle_xings()
     if ((from->type != XingTypeExit) ||
         (to->type != XingTypeEntry) ||
         (from->angle < to->angle))
-      xing_error(__FILE__, __LINE__, nxings-1, nxings, xings);
+    {
+      xing_error(ss, __FILE__, __LINE__, nxings-1, nxings, xings);
+      return;
+    }
 
-    cyl_scan_edge(from, to);
+    cyl_scan_edge(ss, from, to);
 
     for (i=1; i<(nxings-1); i+=2)
     {
@@ -1280,19 +2859,23 @@ void cyl_handle_xings()
 
       if ((from->type != XingTypeExit) ||
           (to->type != XingTypeEntry))
-        xing_error(__FILE__, __LINE__, i, nxings, xings);
+      {
+        xing_error(ss, __FILE__, __LINE__, i, nxings, xings);
+        return;
+      }
 
-      cyl_scan_edge(from, to);
+      cyl_scan_edge(ss, from, to);
     }
   }
 
-  edgexings->count = 0;
+  ss->edgexings->count = 0;
 }
 
 
-void cyl_scan_edge(from, to)
-     EdgeXing *from;
-     EdgeXing *to;
+void cyl_scan_edge(ss, from, to)
+     ScanState *ss;
+     EdgeXing  *from;
+     EdgeXing  *to;
 {
   int    s0, s1, s_new;
   double x_0, x_1, x_new;
@@ -1342,41 +2925,70 @@ void cyl_scan_edge(from, to)
       assert(0);
     }
 
-    scan(x_0, y_0, x_new, y_new);
+    scan(ss, x_0, y_0, x_new, y_new);
     x_0 = x_new;
     y_0 = y_new;
     s0 = s_new;
   }
 
-  scan(x_0, y_0, x_1, y_1);
+  scan(ss, x_0, y_0, x_1, y_1);
 }
 
 
-void xing_error(file, line, idx, nxings, xings)
+/* the edge crossings of a curve don't pair up. simplified curves
+ * can zig-zag back and forth across the horizon (or the edge of the
+ * map) in ways the originals don't, so in that case just note it in
+ * ss and let scan_map() try again with the full-detail curves; with
+ * those, it is fatal.
+ */
+void xing_error(ss, file, line, idx, nxings, xings)
+     ScanState  *ss;
      const char *file;
      int         line;
      int         idx;
      int         nxings;
      EdgeXing   *xings;
 {
+  if (scan_level > 0)
+  {
+    ss->xing_bad         = 1;
+    ss->edgexings->count = 0;
+    return;
+  }
+
   fflush(stdout);
   fprintf(stderr, "xearth %s: incorrect edgexing sequence (%s:%d)\n",
           VersionString, file, line);
-  fprintf(stderr, " (cidx %d) (view_lat %.16f) (view_lon %.16f)\n",
-          xings[idx].cidx, view_lat, view_lon);
+  fprintf(stderr, " (cidx %d) (xing %d of %d)"
+          " (view_lat %.16f) (view_lon %.16f)\n",
+          xings[idx].cidx, idx, nxings, view_lat, view_lon);
   fprintf(stderr, "\n");
   exit(1);
 }
 
 
-void scan(x_0, y_0, x_1, y_1)
-     double x_0, y_0;
-     double x_1, y_1;
+/* add the edge from (x_0, y_0) to (x_1, y_1) to the edge table,
+ * clipped to the rows of the screen and to ss->clip_{lo,hi}_x.
+ * since get_scanbits() pairs up intercepts in order along each row,
+ * edges (or the parts of them) clipped off to the right can simply
+ * be dropped, and those clipped off to the left only matter in that
+ * they flip whether the row starts out inside a curve; that is noted
+ * in ss->left_flip (at the first row flipped and the row after the
+ * last one, so that get_scanbits() can pick it up with a running
+ * xor).
+ */
+void scan(ss, x_0, y_0, x_1, y_1)
+     ScanState *ss;
+     double     x_0, y_0;
+     double     x_1, y_1;
 {
-  int    i;
-  int    lo_y, hi_y;
-  double x_value;
-  double x_delta;
+  int       lo_y, hi_y;
+  int       lo_in, hi_in;
+  int       idx;
+  double    dx;
+  double    lo_x, hi_x;
+  double    clip_lo, clip_hi;
+  ScanEdge *edge;
 
   if (y_0 < y_1)
   {
@@ -1401,54 +3013,275 @@ void scan(x_0, y_0, x_1, y_1)
   if (lo_y > hi_y)
     return;                     /* no scan lines crossed */
 
-  if (lo_y < min_y) min_y = lo_y;
-  if (hi_y > max_y) max_y = hi_y;
+  /* intercepts with the first and last rows crossed
+   */
+  dx   = (x_1 - x_0) / (y_1 - y_0);
+  lo_x = x_0 + dx * ((lo_y + 0.5) - y_0);
+  hi_x = x_0 + dx * ((hi_y + 0.5) - y_0);
+
+  clip_lo = ss->clip_lo_x;
+  clip_hi = ss->clip_hi_x;
+
+  if ((lo_x > clip_hi) && (hi_x > clip_hi))
+    return;                     /* all off to the right */
+
+  if (lo_y < ss->min_y) ss->min_y = lo_y;
+  if (hi_y > ss->max_y) ss->max_y = hi_y;
+
+  if ((lo_x < clip_lo) && (hi_x < clip_lo))
+  {
+    /* all off to the left */
+    ss->left_flip[lo_y]   ^= 1;
+    ss->left_flip[hi_y+1] ^= 1;
+    return;
+  }
+
+  /* find the rows lo_in through hi_in on which the intercept is
+   * within the clip range; the rest are off to the left at one end
+   * and off to the right at the other
+   */
+  lo_in = lo_y;
+  hi_in = hi_y;
+  if (dx > 0)
+  {
+    if (lo_x < clip_lo)
+    {
+      lo_in += ceil((clip_lo - lo_x) / dx);
+      ss->left_flip[lo_y]  ^= 1;
+      ss->left_flip[lo_in] ^= 1;
+    }
+    if (hi_x > clip_hi)
+      hi_in = lo_y + floor((clip_hi - lo_x) / dx);
+  }
+  else if (dx < 0)
+  {
+    if (lo_x > clip_hi)
+      lo_in += ceil((clip_hi - lo_x) / dx);
+    if (hi_x < clip_lo)
+    {
+      hi_in = lo_y + floor((clip_lo - lo_x) / dx);
+      ss->left_flip[hi_in+1] ^= 1;
+      ss->left_flip[hi_y+1]  ^= 1;
+    }
+  }
+
+  if (lo_in > hi_in)
+    return;                     /* jumps straight across */
+
+  /* add an edge to the edge table, in the bucket for the first row
+   * it crosses; get_scanbits() takes it from there
+   */
+  idx  = ss->edges->count;
+  edge = (ScanEdge *) extarr_next(ss->edges);
+
+  edge->dx   = dx;
+  edge->x    = x_0 + dx * ((lo_in + 0.5) - y_0);
+  edge->hi_y = hi_in;
+  edge->next = ss->edge_row[lo_in];
+
+  ss->edge_row[lo_in] = idx;
+}
+
 
-  x_delta = (x_1 - x_0) / (y_1 - y_0);
-  x_value = x_0 + x_delta * ((lo_y + 0.5) - y_0);
+/* empty the edge table without producing any scanbits (when the
+ * current pass is going to be redone anyway; see xing_error())
+ */
+void clear_edges(ss)
+     ScanState *ss;
+{
+  int i;
 
-  for (i=lo_y; i<=hi_y; i++)
+  for (i=ss->min_y; i<=ss->max_y; i++)
   {
-    *((double *) extarr_next(scanbuf[i])) = x_value;
-    x_value += x_delta;
+    ss->edge_row[i]  = -1;
+    ss->left_flip[i] = 0;
   }
+  ss->left_flip[ss->max_y+1] = 0;
+  ss->edges->count = 0;
 }
 
 
-void get_scanbits(val)
-     int val;
+/* sweep rows min_y through max_y, keeping a list of the edges active
+ * on each row sorted by x intercept, and turn each pair of intercepts
+ * into a scanbit (or, if ss->raw_spans is set, a span). the edge
+ * table is empty again when we're done.
+ */
+void get_scanbits(ss, val)
+     ScanState *ss;
+     int        val;
 {
-  int      i, j;
-  int      lo_x, hi_x;
-  unsigned nvals;
-  double  *vals;
-  ScanBit *scanbit;
+  int       i, j, k;
+  int       n, nbits;
+  int       nactive;
+  int      *active;
+  int       tmp;
+  int       inside;
+  int       lo_x, hi_x;
+  double    x;
+  double    lo;
+  ScanEdge *edges;
+  ScanBit  *bit;
+  ScanSpan *span;
+
+  edges   = (ScanEdge *) ss->edges->body;
+  active  = (int *) ss->active->body;
+  nactive = 0;
+  inside  = 0;
+
+  if (ss->active->limit < ss->edges->count)
+  {
+    ss->active->count = 0;
+    active = (int *) extarr_extend(ss->active, ss->edges->count);
+  }
 
-  for (i=min_y; i<=max_y; i++)
+  for (i=ss->min_y; i<=ss->max_y; i++)
   {
-    vals  = (double *) scanbuf[i]->body;
-    nvals = scanbuf[i]->count;
-    assert((nvals % 2) == 0);
-    qsort(vals, nvals, sizeof(double), double_comp);
+    /* move edges that start on this row into the active list
+     */
+    for (tmp=ss->edge_row[i]; tmp>=0; tmp=edges[tmp].next)
+      active[nactive++] = tmp;
+    ss->edge_row[i] = -1;
 
-    for (j=0; j<nvals; j+=2)
+    /* the active list is already sorted (or nearly so) from the
+     * previous row, so insertion sort is the right tool here
+     */
+    for (j=1; j<nactive; j++)
     {
-      lo_x = ceil(vals[j] - 0.5);
-      hi_x = floor(vals[j+1] - 0.5);
+      tmp = active[j];
+      x   = edges[tmp].x;
+      for (k=j; (k > 0) && (edges[active[k-1]].x > x); k--)
+        active[k] = active[k-1];
+      active[k] = tmp;
+    }
+
+    /* pair up the intercepts, starting out inside a curve if an odd
+     * number of edges were clipped off to the left, and ending inside
+     * one if an odd number were clipped off to the right
+     */
+    inside ^= ss->left_flip[i];
+    ss->left_flip[i] = 0;
 
-      if (lo_x < 0)     lo_x = 0;
-      if (hi_x >= wdth) hi_x = wdth-1;
+    if (ss->raw_spans)
+    {
+      k  = inside;
+      lo = ss->clip_lo_x;
+      for (j=0; j<nactive; j++)
+      {
+        if (k)
+        {
+          span = (ScanSpan *) extarr_next(ss->spans);
+          span->y    = i;
+          span->val  = val;
+          span->lo_x = lo;
+          span->hi_x = edges[active[j]].x;
+        }
+        else
+        {
+          lo = edges[active[j]].x;
+        }
+        k = !k;
+      }
+      if (k)
+      {
+        span = (ScanSpan *) extarr_next(ss->spans);
+        span->y    = i;
+        span->val  = val;
+        span->lo_x = lo;
+        span->hi_x = ss->clip_hi_x;
+      }
+    }
+    else if ((nactive > 0) || inside)
+    {
+      /* the pixels in a span are those with centers between the
+       * intercepts; reserve room for as many scanbits as this row
+       * could produce, and give back what isn't used
+       */
+      nbits = (nactive / 2) + 1;
+      bit   = (ScanBit *) extarr_extend(ss->scanbits, (unsigned) nbits);
+      n     = 0;
+      k     = inside;
+      lo_x  = 0;
+      for (j=0; j<nactive; j++)
+      {
+        x = edges[active[j]].x;
+        if (!k)
+        {
+          lo_x = ceil(x - 0.5);
+          if (lo_x < 0) lo_x = 0;
+        }
+        else
+        {
+          hi_x = floor(x - 0.5);
+          if (hi_x >= wdth) hi_x = wdth-1;
+          if (lo_x <= hi_x)
+          {
+            bit[n].y    = i;
+            bit[n].lo_x = lo_x;
+            bit[n].hi_x = hi_x;
+            bit[n].val  = val;
+            n += 1;
+          }
+        }
+        k = !k;
+      }
+      if (k && (lo_x < wdth))
+      {
+        bit[n].y    = i;
+        bit[n].lo_x = lo_x;
+        bit[n].hi_x = wdth-1;
+        bit[n].val  = val;
+        n += 1;
+      }
+      ss->scanbits->count -= nbits - n;
+    }
 
-      if (lo_x <= hi_x)
+    /* step the active edges down to the next row, dropping any that
+     * end on this one
+     */
+    k = 0;
+    for (j=0; j<nactive; j++)
+    {
+      tmp = active[j];
+      if (edges[tmp].hi_y > i)
       {
-        scanbit = (ScanBit *) extarr_next(scanbits);
-        scanbit->y    = i;
-        scanbit->lo_x = lo_x;
-        scanbit->hi_x = hi_x;
-        scanbit->val  = val;
+        edges[tmp].x += edges[tmp].dx;
+        active[k++] = tmp;
       }
     }
+    nactive = k;
+  }
+
+  assert(nactive == 0);
+  ss->left_flip[ss->max_y+1] = 0;
+  ss->edges->count = 0;
+}
+
 
-    scanbuf[i]->count = 0;
+/* add a scanbit for the pixels in row y with centers between x
+ * intercepts lo and hi (if any are on screen)
+ */
+static void add_scanbit(bits, y, lo, hi, val)
+     ExtArr bits;
+     int    y;
+     double lo;
+     double hi;
+     int    val;
+{
+  int      lo_x, hi_x;
+  ScanBit *scanbit;
+
+  lo_x = ceil(lo - 0.5);
+  hi_x = floor(hi - 0.5);
+
+  if (lo_x < 0)     lo_x = 0;
+  if (hi_x >= wdth) hi_x = wdth-1;
+
+  if (lo_x <= hi_x)
+  {
+    scanbit = (ScanBit *) extarr_next(bits);
+    scanbit->y    = y;
+    scanbit->lo_x = lo_x;
+    scanbit->hi_x = hi_x;
+    scanbit->val  = val;
   }
 }
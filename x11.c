@@ -82,6 +82,7 @@ static void         get_shift _P((void));
 static void         get_labelpos _P((void));
 static void         get_geometry _P((void));
 static void         get_ncolors _P((void));
+static void         get_simd _P((void));
 static void         x11_setup _P((void));
 static void         pack_mono_1 _P((u16or32 *, u_char *));
 static void         pack_8 _P((u16or32 *, Pixel *, u_char *));
@@ -159,6 +160,8 @@ static char *defaults[] =
   "*labelpos:   -5-5",
   "*markers:    on",
   "*markerfile: built-in",
+  "*mapdata:    built-in",
+  "*bilinear:   off",
   "*wait:       300",
   "*timewarp:   1",
   "*day:        100",
@@ -169,6 +172,9 @@ static char *defaults[] =
   "*fork:       off",
   "*once:       off",
   "*nice:       0",
+  "*threads:    1",
+  "*simd:       avx2",
+  "*verbose:    off",
   "*stars:      on",
   "*starfreq:   0.002",
   "*bigstars:   0",
@@ -201,6 +207,9 @@ static XrmOptionDescRec options[] =
 { "-nomarkers",   ".markers",     XrmoptionNoArg,  "off" },
 { "-markerfile",  ".markerfile",  XrmoptionSepArg, 0     },
 { "-showmarkers", ".showmarkers", XrmoptionNoArg,  "on"  },
+{ "-mapdata",     ".mapdata",     XrmoptionSepArg, 0     },
+{ "-bilinear",    ".bilinear",    XrmoptionNoArg,  "on"  },
+{ "-nobilinear",  ".bilinear",    XrmoptionNoArg,  "off" },
 { "-overlayfile", ".overlayfile", XrmoptionSepArg, 0     },
 { "-wait",        ".wait",        XrmoptionSepArg, 0     },
 { "-timewarp",    ".timewarp",    XrmoptionSepArg, 0     },
@@ -215,6 +224,10 @@ static XrmOptionDescRec options[] =
 { "-once",        ".once",        XrmoptionNoArg,  "on"  },
 { "-noonce",      ".once",        XrmoptionNoArg,  "off" },
 { "-nice",        ".nice",        XrmoptionSepArg, 0     },
+{ "-threads",     ".threads",     XrmoptionSepArg, 0     },
+{ "-simd",        ".simd",        XrmoptionSepArg, 0     },
+{ "-verbose",     ".verbose",     XrmoptionNoArg,  "on"  },
+{ "-noverbose",   ".verbose",     XrmoptionNoArg,  "off" },
 { "-version",     ".version",     XrmoptionNoArg,  "on"  },
 { "-stars",       ".stars",       XrmoptionNoArg,  "on"  },
 { "-nostars",     ".stars",       XrmoptionNoArg,  "off" },
@@ -310,6 +323,7 @@ static void process_opts()
   get_rotation();
   get_geometry();
   get_ncolors();
+  get_simd();
 
   /* process simple resources
    */
@@ -327,6 +341,10 @@ static void process_opts()
   do_fork         = get_boolean_resource("fork", "Fork");
   do_once         = get_boolean_resource("once", "Once");
   priority        = get_integer_resource("nice", "Nice");
+  num_threads     = get_integer_resource("threads", "Threads");
+  verbose         = get_boolean_resource("verbose", "Verbose");
+  mapdatafile     = get_string_resource("mapdata", "Mapdata");
+  do_bilinear     = get_boolean_resource("bilinear", "Bilinear");
   do_stars        = get_boolean_resource("stars", "Stars");
   star_freq       = get_float_resource("starfreq", "Starfreq");
   big_stars       = get_integer_resource("bigstars", "Bigstars");
@@ -365,8 +383,12 @@ static void process_opts()
     fatal("arg to -term must be between 0 and 100");
   if (xgamma <= 0)
     fatal("arg to -gamma must be positive");
+  if (num_threads <= 0)
+    fatal("arg to -threads must be positive");
   if (strcmp(overlayfile, "none") == 0)
     overlayfile = NULL;
+  if (strcmp(mapdatafile, "built-in") == 0)
+    mapdatafile = NULL;
 
   /* if we're only rendering once, make sure we don't
    * waste memory by allocating two pixmaps
@@ -545,8 +567,8 @@ void x11_output()
   {
     compute_positions();
 
-    /* if we were really clever, we'd only
-     * do this if the position has changed
+    /* scan_map() (and the grid part of do_dots()) only redo the
+     * scan conversion if the view has changed since last time
      */
     scan_map();
     do_dots();
@@ -758,6 +780,21 @@ static void get_ncolors()
 }
 
 
+/* fetch and decode 'simd' resource (SIMD shading kernels)
+ */
+static void get_simd()
+{
+  char *res;
+
+  res = get_string_resource("simd", "Simd");
+  if (res != NULL)
+  {
+    decode_simd(res);
+    free(res);
+  }
+}
+
+
 /* fetch and decode 'labelpos' resource (label position)
  */
 static void get_labelpos()
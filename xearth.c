@@ -61,6 +61,7 @@ extern int errno;
 #define ModeJPEG (4)
 #define ModeBMP  (5)
 #define ModeTest (6)
+#define ModeBench (7)
 
 /* tokens in specifiers are delimited by spaces, tabs, commas, and
  * forward slashes
@@ -110,8 +111,10 @@ int      do_label;              /* label image                 */
 int      do_markers;            /* display markers (X only)    */
 char    *markerfile;            /* for user-spec. marker info  */
 char    *mapfile;               /* for image overlay file      */
+char    *mapdatafile;           /* binary map data file        */
 char    *overlayfile[MAX_OVERLAY]; /* for overlay file             */
 int      overlay_count;         /* number of overlay files     */
+int      do_bilinear;           /* bilinear filtering of above */
 int      wait_time;             /* wait time between redraw    */
 double   time_warp;             /* passage of time multiplier  */
 int      fixed_time;            /* fixed viewing time (ssue)   */
@@ -123,6 +126,9 @@ int      use_two_pixmaps;       /* use two pixmaps? (X only)   */
 int      num_colors;            /* number of colors to use     */
 int      do_fork;               /* fork child process?         */
 int      priority;              /* desired process priority    */
+int      num_threads;           /* number of worker threads    */
+int      use_simd;              /* best SIMD kernels to use    */
+int      verbose;               /* report cache statistics?    */
 
 time_t start_time = 0;
 time_t current_time;
@@ -147,7 +153,7 @@ int main(argc, argv)
   {
     command_line(argc, argv);
 
-    if (isatty(fileno(stdout))) {
+    if ((output_mode != ModeBench) && isatty(fileno(stdout))) {
       usage("xearth refuses to write image data to a tty");
     }
   }
@@ -249,6 +255,10 @@ void output()
     test_mode();
     break;
 
+  case ModeBench:
+    bench_output();
+    break;
+
   default:
     assert(0);
   }
@@ -445,8 +455,8 @@ void pick_random_position(lat_ret, lon_ret)
 
 
 /* look through the command line arguments to figure out if we're
- * using X or not (if "-ppm", "-gif", "-png", "-jpeg", "-bmp", or "-test" is found, we're not
- * using X, otherwise we are).
+ * using X or not (if "-ppm", "-gif", "-png", "-jpeg", "-bmp", "-test",
+ * or "-bench" is found, we're not using X, otherwise we are).
  */
 int using_x(argc, argv)
      int   argc;
@@ -454,8 +464,8 @@ int using_x(argc, argv)
 {
   int i;
 
-  /* loop through the args, break if we find "-ppm", "-gif", "-png", "-jpeg", "-bmp", or
-   * "-test"
+  /* loop through the args, break if we find "-ppm", "-gif", "-png", "-jpeg", "-bmp",
+   * "-test", or "-bench"
    */
   for (i=1; i<argc; i++)
     if ((strcmp(argv[i], "-ppm") == 0) ||
@@ -463,11 +473,12 @@ int using_x(argc, argv)
         (strcmp(argv[i], "-png") == 0) ||
         (strcmp(argv[i], "-jpeg") == 0) ||
         (strcmp(argv[i], "-bmp") == 0) ||
-        (strcmp(argv[i], "-test") == 0))
+        (strcmp(argv[i], "-test") == 0) ||
+        (strcmp(argv[i], "-bench") == 0))
       break;
 
-  /* if we made it through the loop without finding "-ppm", "-gif", "-png", "-jpeg", "-bmp", or
-   * "-test" (and breaking out), assume we're using X.
+  /* if we made it through the loop without finding "-ppm", "-gif", "-png", "-jpeg", "-bmp",
+   * "-test", or "-bench" (and breaking out), assume we're using X.
    */
   return (i == argc);
 }
@@ -504,6 +515,11 @@ void set_defaults()
   num_colors       = 64;
   do_fork          = 0;
   priority         = 0;
+  num_threads      = 1;
+  use_simd         = SimdAVX2;
+  verbose          = 0;
+  mapdatafile      = NULL;
+  do_bilinear      = 0;
   do_stars         = 1;
   star_freq        = 0.002;
   big_stars        = 0;
@@ -613,6 +629,15 @@ void command_line(argc, argv)
     {
       warning("-showmarkers not relevant for GIF or PPM output");
     }
+    else if (strcmp(argv[i], "-mapdata") == 0)
+    {
+      i += 1;
+      if (i >= argc) usage("missing arg to -mapdata");
+      if (strcmp(argv[i], "built-in") == 0)
+        mapdatafile = NULL;
+      else
+        mapdatafile = argv[i];
+    }
     else if (strcmp(argv[i], "-stars") == 0)
     {
       do_stars = 1;
@@ -697,6 +722,14 @@ void command_line(argc, argv)
       if (i >= argc) usage("missing arg to -overlayfile");
       decode_overlay(argv[i]);
     }
+    else if (strcmp(argv[i], "-bilinear") == 0)
+    {
+      do_bilinear = 1;
+    }
+    else if (strcmp(argv[i], "-nobilinear") == 0)
+    {
+      do_bilinear = 0;
+    }
     else if (strcmp(argv[i], "-gamma") == 0)
     {
       i += 1;
@@ -804,6 +837,28 @@ void command_line(argc, argv)
       if (i >= argc) usage("missing arg to -nice");
       sscanf(argv[i], "%d", &priority);
     }
+    else if (strcmp(argv[i], "-threads") == 0)
+    {
+      i += 1;
+      if (i >= argc) usage("missing arg to -threads");
+      sscanf(argv[i], "%d", &num_threads);
+      if (num_threads <= 0)
+        fatal("arg to -threads must be positive");
+    }
+    else if (strcmp(argv[i], "-simd") == 0)
+    {
+      i += 1;
+      if (i >= argc) usage("missing arg to -simd");
+      decode_simd(argv[i]);
+    }
+    else if (strcmp(argv[i], "-verbose") == 0)
+    {
+      verbose = 1;
+    }
+    else if (strcmp(argv[i], "-noverbose") == 0)
+    {
+      verbose = 0;
+    }
     else if (strcmp(argv[i], "-version") == 0)
     {
       version_info(1);
@@ -832,6 +887,15 @@ void command_line(argc, argv)
     {
       output_mode = ModeTest;
     }
+    else if (strcmp(argv[i], "-bench") == 0)
+    {
+      i += 1;
+      if (i >= argc) usage("missing arg to -bench");
+      sscanf(argv[i], "%d", &bench_frames);
+      if (bench_frames <= 0)
+        fatal("arg to -bench must be positive");
+      output_mode = ModeBench;
+    }
     else if (strcmp(argv[i], "-display") == 0)
     {
       warning("-display not relevant for GIF or PPM output");
@@ -969,6 +1033,37 @@ void decode_proj_type(s)
 }
 
 
+/* decode the best instruction set the shading kernels may use; three
+ * possibilities:
+ *
+ *  none  - just the scalar kernels
+ *  sse2  - SSE2 kernels, if compiled in
+ *  avx2  - AVX2 kernels, if compiled in and the CPU has AVX2 (the
+ *          default; otherwise, the best of the above)
+ */
+void decode_simd(s)
+     char *s;
+{
+  if (strcmp(s, "none") == 0)
+  {
+    use_simd = SimdNone;
+  }
+  else if (strcmp(s, "sse2") == 0)
+  {
+    use_simd = SimdSSE2;
+  }
+  else if (strcmp(s, "avx2") == 0)
+  {
+    use_simd = SimdAVX2;
+  }
+  else
+  {
+    sprintf(errmsgbuf, "unknown instruction set (%s)", s);
+    fatal(errmsgbuf);
+  }
+}
+
+
 /* decode viewing position specifier; five possibilities:
  *
  *  fixed lat lon  - viewing position fixed wrt earth at (lat, lon)
@@ -1373,14 +1468,18 @@ void usage(msg)
   fprintf(stderr, " [-sunpos sun_pos_spec] [-mag factor] [-size size_spec]\n");
   fprintf(stderr, " [-shift shift_spec] [-shade|-noshade] [-label|-nolabel]\n");
   fprintf(stderr, " [-labelpos geom] [-markers|-nomarkers] [-markerfile file]\n");
-  fprintf(stderr, " [-showmarkers] [-stars|-nostars] [-starfreq frequency]\n");
+  fprintf(stderr, " [-showmarkers] [-mapdata file] [-stars|-nostars] [-starfreq frequency]\n");
   fprintf(stderr, " [-bigstars percent] [-grid|-nogrid] [-grid1 grid1] [-grid2 grid2]\n");
+  fprintf(stderr, " [-mapfile file] [-overlayfile file] [-bilinear|-nobilinear]\n");
   fprintf(stderr, " [-day pct] [-night pct] [-term pct] [-gamma gamma_value]\n");
   fprintf(stderr, " [-wait secs] [-timewarp factor] [-time fixed_time]\n");
   fprintf(stderr, " [-onepix|-twopix] [-mono|-nomono] [-ncolors num_colors]\n");
   fprintf(stderr, " [-font font_name] [-root|-noroot] [-geometry geom] [-title title]\n");
   fprintf(stderr, " [-iconname iconname] [-name name] [-fork|-nofork] [-once|-noonce]\n");
-  fprintf(stderr, " [-nice priority] [-gif] [-png] [-jpeg] [-bmp] [-ppm] [-display dpyname] [-version]\n");
+  fprintf(stderr, " [-nice priority] [-threads nthreads] [-simd none|sse2|avx2]\n");
+  fprintf(stderr, " [-verbose|-noverbose]\n");
+  fprintf(stderr, " [-gif] [-png] [-jpeg] [-bmp] [-ppm] [-bench frames]\n");
+  fprintf(stderr, " [-display dpyname] [-version]\n");
   fprintf(stderr, "\n");
   exit(1);
 }
@@ -110,6 +110,41 @@ typedef unsigned short u_short;
 #define PixBlue(p)  (((p)      ) & 0xff)
 #define PixRGB(r,g,b) ((((r) & 0xff) << 16) | (((g) & 0xff) << 8) | ((b) & 0xff))
 
+/* map_data[] points are unit vectors scaled by this much
+ */
+#define MapDataScale (30000)
+
+/* binary map data files (see mapbin.c); numbers are stored as
+ * native ints and floats, and MapBinByteOrder (and sizeof the
+ * header) let files from machines that differ be recognized
+ */
+#define MapBinMagic     "XEARTHMP"
+#define MapBinVersion   (1)
+#define MapBinByteOrder (0x01020304)
+#define MapBinAlign     (64)
+
+/* tiled texture files (see img2tex.c and overlay.c) follow the same
+ * conventions; the tiles start on a page boundary so that reading a
+ * tile only brings in the pages it is on
+ */
+#define TexBinMagic     "XEARTHTX"
+#define TexBinVersion   (1)
+#define TexBinAlign     (4096)
+#define TexBinMaxLevels (32)
+#define TexBinMinShift  (4)
+#define TexBinMaxShift  (10)
+
+/* texels (in memory and in tiled texture files) are packed into
+ * words as red, green, blue and gd's alpha (0 = opaque, 127 =
+ * transparent), from the top byte down
+ */
+#define TexRGBA(r,g,b,a) \
+  (((u8or32) (r) << 24) | ((g) << 16) | ((b) << 8) | (a))
+#define TexRed(t)   (((t) >> 24) & 0xff)
+#define TexGreen(t) (((t) >> 16) & 0xff)
+#define TexBlue(t)  (((t) >>  8) & 0xff)
+#define TexAlpha(t) (((t)      ) & 0xff)
+
 /* types of dots
  */
 #define DotTypeStar (0)
@@ -134,6 +169,12 @@ typedef unsigned short u_short;
 #define ProjTypeMercator     (1)
 #define ProjTypeCylindrical  (2)
 
+/* instruction sets the shading kernels can use (see -simd)
+ */
+#define SimdNone (0)
+#define SimdSSE2 (1)
+#define SimdAVX2 (2)
+
 /* types of marker label alignment
  */
 #define MarkerAlignDefault (0)
@@ -213,6 +254,7 @@ typedef struct
   double cos_lat, sin_lat;	/* cos/sin of view_lat */
   double cos_lon, sin_lon;	/* cos/sin of view_lon */
   double cos_rot, sin_rot;	/* cos/sin of view_rot */
+  double xform[3][3];		/* all three, as a matrix */
 } ViewPosInfo;
 
 typedef struct
@@ -246,6 +288,82 @@ typedef struct
   int   align;
 } MarkerInfo;
 
+/* where a pixel lands on the map and overlay images of one size (see
+ * tex_coord() in overlay.c)
+ */
+typedef struct
+{
+  int u, v;
+} TexCoord;
+
+/* a binary map data file starts with a MapBinHeader. the curve index
+ * (ncurves MapBinCurves) is at curve_ofs, and the points of all the
+ * curves, one after another, are stored as three arrays of npoints
+ * floats (x, y, and z of the unit vectors, with axes as in
+ * map_data[]) at x_ofs, y_ofs, and z_ofs. all the offsets are in
+ * bytes from the start of the file and multiples of MapBinAlign.
+ */
+typedef struct
+{
+  char magic[8];                /* MapBinMagic (no trailing NUL) */
+  int  byte_order;              /* MapBinByteOrder               */
+  int  version;                 /* MapBinVersion                 */
+  int  header_size;             /* sizeof(MapBinHeader)          */
+  int  ncurves;                 /* number of curves              */
+  int  npoints;                 /* total number of points        */
+  int  curve_ofs;               /* offset of curve index         */
+  int  x_ofs, y_ofs, z_ofs;     /* offsets of point coordinates  */
+} MapBinHeader;
+
+typedef struct
+{
+  int npts;                     /* number of points in curve     */
+  int val;                      /* 1 for land, -1 for water      */
+} MapBinCurve;
+
+/* a tiled texture file starts with a TexBinHeader, followed (at
+ * tile_ofs) by the tiles of each level of detail in turn. level 0
+ * is the image as is, and each level after that half the size of
+ * the one before (2x2 blocks of texels averaged, an odd last row or
+ * column dropped), as overlay.c would make them. a level's tiles
+ * are stored row by row, each tile as (1 << tile_shift) rows of
+ * (1 << tile_shift) texels; tiles hanging off the right or bottom
+ * of the image are padded out with zeros.
+ */
+typedef struct
+{
+  int sx, sy;                   /* size in texels                */
+  int tiles_x, tiles_y;         /* size in tiles                 */
+  int first_tile;               /* tiles before this level's     */
+} TexBinLevel;
+
+typedef struct
+{
+  char        magic[8];         /* TexBinMagic (no trailing NUL) */
+  int         byte_order;       /* MapBinByteOrder               */
+  int         version;          /* TexBinVersion                 */
+  int         header_size;      /* sizeof(TexBinHeader)          */
+  int         tile_shift;       /* log2 of tile size in texels   */
+  int         alpha;            /* blend by alpha (else screen)? */
+  int         nlevels;          /* levels of detail              */
+  int         tile_ofs;         /* offset of first tile          */
+  TexBinLevel level[TexBinMaxLevels];
+} TexBinHeader;
+
+/* a binary map data file, as loaded by mapbin_load()
+ */
+typedef struct
+{
+  int          ncurves;
+  int          npoints;
+  MapBinCurve *curves;
+  float       *x, *y, *z;
+} MapBinData;
+
+/* bench.c */
+extern int  bench_frames;
+extern void bench_output _P((void));
+
 /* bmp.c */
 extern void bmp_output _P((void));
 
@@ -272,6 +390,11 @@ extern void jpeg_output _P((void));
 /* mapdata.c */
 extern short map_data[];
 
+/* mapbin.c */
+extern void  mapbin_load _P((const char *, MapBinData *));
+extern char *map_file _P((const char *, long *));
+extern void  unmap_file _P((char *, long));
+
 /* markers.c */
 extern MarkerInfo *marker_info;
 extern void        load_marker_info _P((char *));
@@ -279,9 +402,18 @@ extern void        show_marker_info _P((char *));
 
 /* overlay.c */
 extern void overlay_init _P((void));
-extern int map_pixel _P((double, double));
-extern int overlay_pixel _P((double, double, int));
-extern void overlay_close _P((void));
+extern int tex_groups _P((int *));
+extern void tex_coord _P((double, double, TexCoord *));
+extern int map_pixel _P((TexCoord *));
+extern int overlay_pixel _P((TexCoord *, int));
+extern int gd_map_open _P((void));
+extern int gd_map_pixel _P((double, double));
+extern void gd_map_close _P((void));
+
+/* pool.c */
+extern void pool_run _P((int, void (*)(int, void *), void *));
+extern void pool_deal _P((int, int));
+extern int  pool_next _P((int));
 
 /* png.c */
 extern void png_output _P((void));
@@ -304,6 +436,8 @@ extern unsigned int get_pixel_resource _P((const char *, const char *));
 extern ViewPosInfo view_pos_info;
 extern ProjInfo    proj_info;
 extern ExtArr      scanbits;
+extern int        *scanbit_row;
+extern int         scan_reused;
 extern void        scan_map _P((void));
 
 /* sunpos.c */
@@ -340,6 +474,7 @@ extern char  *markerfile;
 extern char  *mapfile;
 extern char  *overlayfile[MAX_OVERLAY];
 extern int    overlay_count;
+extern int    do_bilinear;
 extern int    wait_time;
 extern double time_warp;
 extern int    fixed_time;
@@ -351,11 +486,16 @@ extern int    use_two_pixmaps;
 extern int    num_colors;
 extern int    do_fork;
 extern int    priority;
+extern int    num_threads;
+extern int    use_simd;
+extern int    verbose;
+extern char  *mapdatafile;
 extern time_t current_time;
 
 extern void   compute_positions _P((void));
 extern char **tokenize _P((char *, int *, const char **));
 extern void   decode_proj_type _P((char *));
+extern void   decode_simd _P((char *));
 extern void   decode_rotation _P((char *));
 extern void   decode_viewing_pos _P((char *));
 extern void   decode_sun_pos _P((char *));